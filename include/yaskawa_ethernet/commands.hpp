@@ -30,6 +30,9 @@
 #include "types.hpp"
 
 #include <cstdint>
+#include <string>
+#include <utility>
+#include <variant>
 #include <vector>
 
 namespace dr {
@@ -64,7 +67,7 @@ struct MoveL {
 template<typename T>
 struct ReadVar {
 	using Response = T;
-	std::uint8_t index;
+	std::uint16_t index;
 };
 
 /// Read a sequence of variables from the robot.
@@ -74,8 +77,25 @@ struct ReadVar {
 template<typename T>
 struct ReadVars {
 	using Response = std::vector<T>;
-	std::uint8_t index;
-	std::uint8_t count;
+	std::uint16_t index;
+	std::uint16_t count;
+};
+
+/// Read a sequence of variables from the robot into caller-owned storage.
+/**
+ * The output must point to storage for at least count values,
+ * and it must remain valid until the command finishes.
+ * The values are decoded straight into the output, so no vector is allocated for the response.
+ * If the command fails, the output may be partially overwritten.
+ *
+ * See ReadVar<T> for a list of supported types.
+ */
+template<typename T>
+struct ReadVarsInto {
+	using Response = void;
+	std::uint16_t index;
+	std::uint16_t count;
+	T * output;
 };
 
 /// Write a variable from the robot.
@@ -85,7 +105,7 @@ struct ReadVars {
 template<typename T>
 struct WriteVar {
 	using Response = void;
-	std::uint8_t index;
+	std::uint16_t index;
 	T value;
 };
 
@@ -96,34 +116,70 @@ struct WriteVar {
 template<typename T>
 struct WriteVars {
 	using Response = void;
-	std::uint8_t index;
+	std::uint16_t index;
 	std::vector<T> values;
 };
 
-using ReadUint8Var   = ReadVar   <std::uint8_t>;
-using ReadUint8Vars  = ReadVars  <std::uint8_t>;
-using WriteUint8Var  = WriteVar  <std::uint8_t>;
-using WriteUint8Vars = WriteVars <std::uint8_t>;
-
-using ReadInt16Var   = ReadVar   <std::int16_t>;
-using ReadInt16Vars  = ReadVars  <std::int16_t>;
-using WriteInt16Var  = WriteVar  <std::int16_t>;
-using WriteInt16Vars = WriteVars <std::int16_t>;
-
-using ReadInt32Var   = ReadVar   <std::int32_t>;
-using ReadInt32Vars  = ReadVars  <std::int32_t>;
-using WriteInt32Var  = WriteVar  <std::int32_t>;
-using WriteInt32Vars = WriteVars <std::int32_t>;
-
-using ReadFloat32Var   = ReadVar   <float>;
-using ReadFloat32Vars  = ReadVars  <float>;
-using WriteFloat32Var  = WriteVar  <float>;
-using WriteFloat32Vars = WriteVars <float>;
-
-using ReadPositionVar   = ReadVar   <Position>;
-using ReadPositionVars  = ReadVars  <Position>;
-using WritePositionVar  = WriteVar  <Position>;
-using WritePositionVars = WriteVars <Position>;
+using ReadUint8Var      = ReadVar      <std::uint8_t>;
+using ReadUint8Vars     = ReadVars     <std::uint8_t>;
+using ReadUint8VarsInto = ReadVarsInto <std::uint8_t>;
+using WriteUint8Var     = WriteVar     <std::uint8_t>;
+using WriteUint8Vars    = WriteVars    <std::uint8_t>;
+
+using ReadInt16Var      = ReadVar      <std::int16_t>;
+using ReadInt16Vars     = ReadVars     <std::int16_t>;
+using ReadInt16VarsInto = ReadVarsInto <std::int16_t>;
+using WriteInt16Var     = WriteVar     <std::int16_t>;
+using WriteInt16Vars    = WriteVars    <std::int16_t>;
+
+using ReadInt32Var      = ReadVar      <std::int32_t>;
+using ReadInt32Vars     = ReadVars     <std::int32_t>;
+using ReadInt32VarsInto = ReadVarsInto <std::int32_t>;
+using WriteInt32Var     = WriteVar     <std::int32_t>;
+using WriteInt32Vars    = WriteVars    <std::int32_t>;
+
+using ReadFloat32Var      = ReadVar      <float>;
+using ReadFloat32Vars     = ReadVars     <float>;
+using ReadFloat32VarsInto = ReadVarsInto <float>;
+using WriteFloat32Var     = WriteVar     <float>;
+using WriteFloat32Vars    = WriteVars    <float>;
+
+using ReadPositionVar      = ReadVar      <Position>;
+using ReadPositionVars     = ReadVars     <Position>;
+using ReadPositionVarsInto = ReadVarsInto <Position>;
+using WritePositionVar     = WriteVar     <Position>;
+using WritePositionVars    = WriteVars    <Position>;
+
+/// Value of a variable of any supported type.
+using VarValue = std::variant<std::uint8_t, std::int16_t, std::int32_t, float, Position>;
+
+/// Read or write of a single variable, for batches that are only known at runtime.
+/**
+ * The type of the variable is the type held by the value.
+ * For reads, the value is only used to select the type.
+ */
+struct VarAccess {
+	/// The variable index.
+	std::uint16_t index;
+
+	/// True to write the variable, false to read it.
+	bool write;
+
+	/// The value to write, or a value of the type to read.
+	VarValue value;
+
+	/// Create a read of a variable of type T.
+	template<typename T>
+	static VarAccess reading(std::uint16_t index) {
+		return {index, false, T{}};
+	}
+
+	/// Create a write of a variable.
+	template<typename T>
+	static VarAccess writing(std::uint16_t index, T value) {
+		return {index, true, std::move(value)};
+	}
+};
 
 struct ReadFileList {
 	using Response = std::vector<std::string>;
@@ -146,4 +202,41 @@ struct DeleteFile {
 	std::string name;
 };
 
+/// Any command, for batches of commands that are only known at runtime.
+using AnyCommand = std::variant<
+	ReadStatus,
+	ReadCurrentPosition,
+	MoveL,
+	ReadUint8Var,    ReadUint8Vars,    ReadUint8VarsInto,    WriteUint8Var,    WriteUint8Vars,
+	ReadInt16Var,    ReadInt16Vars,    ReadInt16VarsInto,    WriteInt16Var,    WriteInt16Vars,
+	ReadInt32Var,    ReadInt32Vars,    ReadInt32VarsInto,    WriteInt32Var,    WriteInt32Vars,
+	ReadFloat32Var,  ReadFloat32Vars,  ReadFloat32VarsInto,  WriteFloat32Var,  WriteFloat32Vars,
+	ReadPositionVar, ReadPositionVars, ReadPositionVarsInto, WritePositionVar, WritePositionVars,
+	ReadFileList,
+	ReadFile,
+	WriteFile,
+	DeleteFile
+>;
+
+/// Response to any command.
+/**
+ * Commands without response data (such as writes) produce std::monostate.
+ */
+using AnyResponse = std::variant<
+	std::monostate,
+	Status,
+	Position,
+	std::uint8_t,
+	std::int16_t,
+	std::int32_t,
+	float,
+	std::vector<std::uint8_t>,
+	std::vector<std::int16_t>,
+	std::vector<std::int32_t>,
+	std::vector<float>,
+	std::vector<Position>,
+	std::vector<std::string>,
+	std::string
+>;
+
 }}
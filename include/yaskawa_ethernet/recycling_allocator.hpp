@@ -0,0 +1,219 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace dr {
+namespace yaskawa {
+
+/// Thread local cache of memory blocks for short-lived objects.
+/**
+ * Blocks are grouped in size classes of 64 bytes, up to 1024 bytes.
+ * Released blocks are kept for reuse (up to a limit per size class),
+ * so that objects that are created and destroyed repeatedly do not hit the heap after warm-up.
+ * Larger blocks are always allocated and freed directly.
+ *
+ * Blocks may be released on a different thread than they were allocated on.
+ */
+class RecyclingCache {
+	static constexpr std::size_t granularity  = 64;
+	static constexpr std::size_t size_classes = 16;
+	static constexpr std::size_t max_cached   = 64;
+
+	struct FreeBlock {
+		FreeBlock * next;
+	};
+
+	std::array<FreeBlock *, size_classes> free_{};
+	std::array<std::size_t, size_classes> count_{};
+
+	/// Set when the cache of the current thread is destroyed, after which memory is freed directly.
+	inline static thread_local bool destroyed_ = false;
+
+	RecyclingCache() = default;
+
+	~RecyclingCache() {
+		destroyed_ = true;
+		for (FreeBlock * block : free_) {
+			while (block) ::operator delete(std::exchange(block, block->next));
+		}
+	}
+
+	/// Get the cache for the current thread.
+	static RecyclingCache & local() {
+		thread_local RecyclingCache cache;
+		return cache;
+	}
+
+	/// Get the size class for a block (0 if the block is too large to cache).
+	static constexpr std::size_t sizeClass(std::size_t size) {
+		std::size_t index = (size + granularity - 1) / granularity;
+		if (index == 0) return 1;
+		if (index > size_classes) return 0;
+		return index;
+	}
+
+public:
+	RecyclingCache(RecyclingCache const &) = delete;
+	RecyclingCache & operator=(RecyclingCache const &) = delete;
+
+	/// Allocate a block of at least the given size.
+	static void * allocate(std::size_t size) {
+		std::size_t index = sizeClass(size);
+		if (index == 0) return ::operator new(size);
+
+		// Always allocate the full size class, since the block may be cached when it is released on another thread.
+		if (destroyed_) return ::operator new(index * granularity);
+		RecyclingCache & cache = local();
+		if (FreeBlock * block = cache.free_[index - 1]) {
+			cache.free_[index - 1] = block->next;
+			--cache.count_[index - 1];
+			return block;
+		}
+		return ::operator new(index * granularity);
+	}
+
+	/// Release a block allocated with the given size.
+	static void deallocate(void * pointer, std::size_t size) noexcept {
+		std::size_t index = sizeClass(size);
+		if (index == 0 || destroyed_) return ::operator delete(pointer);
+		RecyclingCache & cache = local();
+		if (cache.count_[index - 1] >= max_cached) return ::operator delete(pointer);
+		cache.free_[index - 1] = new (pointer) FreeBlock{cache.free_[index - 1]};
+		++cache.count_[index - 1];
+	}
+};
+
+/// Allocator that takes memory from the thread local RecyclingCache.
+/**
+ * Useful with std::allocate_shared for objects that are created for every command.
+ */
+template<typename T>
+struct RecyclingAllocator {
+	using value_type = T;
+
+	RecyclingAllocator() = default;
+
+	template<typename U>
+	RecyclingAllocator(RecyclingAllocator<U> const &) noexcept {}
+
+	T * allocate(std::size_t n) {
+		return static_cast<T *>(RecyclingCache::allocate(n * sizeof(T)));
+	}
+
+	void deallocate(T * pointer, std::size_t n) noexcept {
+		RecyclingCache::deallocate(pointer, n * sizeof(T));
+	}
+
+	template<typename U> bool operator==(RecyclingAllocator<U> const &) const noexcept { return true; }
+	template<typename U> bool operator!=(RecyclingAllocator<U> const &) const noexcept { return false; }
+};
+
+/// Wrapper for asynchronous completion handlers that allocates the operation from the RecyclingCache.
+/**
+ * The memory for the asynchronous operation is obtained through the associated allocator of the handler.
+ */
+template<typename Handler>
+class RecyclingHandler {
+	Handler handler_;
+
+public:
+	using allocator_type = RecyclingAllocator<void>;
+
+	explicit RecyclingHandler(Handler handler) : handler_(std::move(handler)) {}
+
+	/// Get the associated allocator of the handler.
+	allocator_type get_allocator() const noexcept { return {}; }
+
+	template<typename... Args>
+	void operator() (Args && ... args) {
+		handler_(std::forward<Args>(args)...);
+	}
+};
+
+/// Wrap a completion handler so the asynchronous operation is allocated from the RecyclingCache.
+template<typename Handler>
+RecyclingHandler<std::decay_t<Handler>> recycling(Handler && handler) {
+	return RecyclingHandler<std::decay_t<Handler>>{std::forward<Handler>(handler)};
+}
+
+/// Thread local cache of byte buffers that keep their capacity.
+class BufferCache {
+	static constexpr std::size_t max_cached = 64;
+
+	std::vector<std::vector<std::uint8_t>> buffers_;
+
+	/// Set when the cache of the current thread is destroyed.
+	inline static thread_local bool destroyed_ = false;
+
+	BufferCache() {
+		buffers_.reserve(max_cached);
+	}
+
+	~BufferCache() {
+		destroyed_ = true;
+	}
+
+	/// Get the cache for the current thread.
+	static BufferCache & local() {
+		thread_local BufferCache cache;
+		return cache;
+	}
+
+public:
+	BufferCache(BufferCache const &) = delete;
+	BufferCache & operator=(BufferCache const &) = delete;
+
+	/// Get an empty buffer, reusing the capacity of a recycled buffer if possible.
+	static std::vector<std::uint8_t> take() {
+		if (destroyed_) return {};
+		BufferCache & cache = local();
+		if (cache.buffers_.empty()) return {};
+		std::vector<std::uint8_t> buffer = std::move(cache.buffers_.back());
+		cache.buffers_.pop_back();
+		return buffer;
+	}
+
+	/// Give a buffer back to the cache.
+	static void recycle(std::vector<std::uint8_t> && buffer) {
+		if (destroyed_ || buffer.capacity() == 0) return;
+		BufferCache & cache = local();
+		if (cache.buffers_.size() >= max_cached) return;
+		buffer.clear();
+		cache.buffers_.push_back(std::move(buffer));
+	}
+};
+
+}}
@@ -0,0 +1,172 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace dr {
+namespace yaskawa {
+
+template<typename Signature, std::size_t InlineSize = 4 * sizeof(void *)>
+class SmallFunction;
+
+/// Move-only type erased function object with inline storage for small functors.
+/**
+ * Functors that fit in InlineSize bytes (and are nothrow move constructible)
+ * are stored inline and never cause a heap allocation.
+ * Larger functors are allocated on the heap.
+ */
+template<typename R, typename... Args, std::size_t InlineSize>
+class SmallFunction<R(Args...), InlineSize> {
+	/// Type erased operations on the stored functor.
+	struct Operations {
+		R    (*invoke)(void * storage, Args && ... args);
+		void (*move)(void * from, void * to) noexcept;
+		void (*destroy)(void * storage) noexcept;
+	};
+
+	/// Check if a functor type is stored inline.
+	template<typename F>
+	static constexpr bool is_inline = sizeof(F) <= InlineSize
+		&& alignof(std::max_align_t) % alignof(F) == 0
+		&& std::is_nothrow_move_constructible<F>::value;
+
+	/// Operations for functors stored inline.
+	template<typename F>
+	struct InlineOperations {
+		static F & get(void * storage) { return *std::launder(reinterpret_cast<F *>(storage)); }
+
+		static R invoke(void * storage, Args && ... args) {
+			return get(storage)(std::forward<Args>(args)...);
+		}
+
+		static void move(void * from, void * to) noexcept {
+			new (to) F(std::move(get(from)));
+			get(from).~F();
+		}
+
+		static void destroy(void * storage) noexcept {
+			get(storage).~F();
+		}
+
+		static constexpr Operations operations{&invoke, &move, &destroy};
+	};
+
+	/// Operations for functors stored on the heap.
+	template<typename F>
+	struct HeapOperations {
+		static F * & get(void * storage) { return *std::launder(reinterpret_cast<F * *>(storage)); }
+
+		static R invoke(void * storage, Args && ... args) {
+			return (*get(storage))(std::forward<Args>(args)...);
+		}
+
+		static void move(void * from, void * to) noexcept {
+			new (to) F *(get(from));
+		}
+
+		static void destroy(void * storage) noexcept {
+			delete get(storage);
+		}
+
+		static constexpr Operations operations{&invoke, &move, &destroy};
+	};
+
+	/// Storage for the functor (or a pointer to it).
+	alignas(std::max_align_t) unsigned char storage_[InlineSize];
+
+	/// Operations for the stored functor, or null if empty.
+	Operations const * operations_ = nullptr;
+
+public:
+	/// Construct an empty function.
+	SmallFunction() noexcept = default;
+
+	/// Construct an empty function.
+	SmallFunction(std::nullptr_t) noexcept {}
+
+	/// Construct a function from a functor.
+	template<typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, SmallFunction>::value>>
+	SmallFunction(F && functor) {
+		using Functor = std::decay_t<F>;
+		static_assert(sizeof(void *) <= InlineSize, "InlineSize must be able to hold a pointer");
+		if constexpr (is_inline<Functor>) {
+			new (storage_) Functor(std::forward<F>(functor));
+			operations_ = &InlineOperations<Functor>::operations;
+		} else {
+			new (storage_) Functor *(new Functor(std::forward<F>(functor)));
+			operations_ = &HeapOperations<Functor>::operations;
+		}
+	}
+
+	SmallFunction(SmallFunction && other) noexcept {
+		if (other.operations_) {
+			other.operations_->move(other.storage_, storage_);
+			operations_ = std::exchange(other.operations_, nullptr);
+		}
+	}
+
+	SmallFunction & operator=(SmallFunction && other) noexcept {
+		if (this == &other) return *this;
+		reset();
+		if (other.operations_) {
+			other.operations_->move(other.storage_, storage_);
+			operations_ = std::exchange(other.operations_, nullptr);
+		}
+		return *this;
+	}
+
+	SmallFunction & operator=(std::nullptr_t) noexcept {
+		reset();
+		return *this;
+	}
+
+	~SmallFunction() {
+		reset();
+	}
+
+	/// Destroy the stored functor, if any.
+	void reset() noexcept {
+		if (operations_) std::exchange(operations_, nullptr)->destroy(storage_);
+	}
+
+	/// Check if the function holds a functor.
+	explicit operator bool() const noexcept {
+		return operations_ != nullptr;
+	}
+
+	/// Invoke the stored functor.
+	R operator()(Args ... args) {
+		return operations_->invoke(storage_, std::forward<Args>(args)...);
+	}
+};
+
+}}
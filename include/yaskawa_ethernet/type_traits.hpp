@@ -26,6 +26,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cstddef>
 #include <type_traits>
 #include <utility>
 
@@ -40,12 +41,20 @@ namespace detail {
 	/// Unpack a tuple and map the type T of each tuple element to Converter<T>::type.
 	template<template<typename> typename Converter, typename... T>
 	auto map_tuple_elements(std::tuple<T...>) -> std::tuple<typename Converter<T>::type...>;
+
+	/// Unpack an index sequence and map each index I to Converter<I>::type.
+	template<template<std::size_t> typename Converter, std::size_t... I>
+	auto map_tuple_indices(std::index_sequence<I...>) -> std::tuple<typename Converter<I>::type...>;
 }
 
 /// Map the type T of each tuple element to Converter<T>::type.
 template<typename Tuple, template<typename> typename Converter>
 using map_tuple_t = decltype(detail::map_tuple_elements<Converter>(std::declval<Tuple>()));
 
+/// Create a tuple with element type Converter<I>::type for each index I in [0, N).
+template<std::size_t N, template<std::size_t> typename Converter>
+using index_tuple_t = decltype(detail::map_tuple_indices<Converter>(std::make_index_sequence<N>()));
+
 /// Empty type.
 struct Empty {};
 
@@ -262,7 +262,7 @@ public:
 		return frame_ == other.frame_
 			&& type_ == other.type_
 			&& tool_ == other.tool_
-			&& static_cast<std::array<double, 6> const &>(*this) == other;
+			&& static_cast<std::array<double, 6> const &>(*this) == static_cast<std::array<double, 6> const &>(other);
 	}
 
 	bool operator!=(CartesianPosition const & other) const {
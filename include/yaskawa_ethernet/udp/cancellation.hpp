@@ -0,0 +1,131 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+/// Signal to cancel a group of commands at once.
+/**
+ * Commands are connected to a signal by sending them with a handler wrapped by bindCancellation().
+ * Cancelling the signal resolves all connected commands that are still in progress
+ * with asio::error::operation_aborted.
+ * Their request IDs, timers and places in the submission queue are released immediately,
+ * so they stop occupying the in-flight window right away.
+ *
+ * A signal can be reused after it was cancelled: commands connected later are not affected.
+ * The signal must outlive the calls to Client::sendCommand() that connect to it,
+ * but it does not keep the commands alive.
+ *
+ * Like the rest of the client, the signal must only be used from the thread running the io_service.
+ */
+class CancellationSignal {
+	struct Slot {
+		std::weak_ptr<void> session;
+		void (*cancel)(void * session);
+	};
+
+	std::vector<Slot> slots_;
+
+public:
+	CancellationSignal() = default;
+
+	// Slots are registered by address, so a signal can not be copied.
+	CancellationSignal(CancellationSignal const &) = delete;
+	CancellationSignal & operator=(CancellationSignal const &) = delete;
+
+	/// Connect a session to the signal.
+	/**
+	 * The session must have a cancel() member function.
+	 */
+	template<typename Session>
+	void connect(std::shared_ptr<Session> const & session) {
+		// Forget finished sessions before growing the list.
+		if (slots_.size() == slots_.capacity()) {
+			slots_.erase(std::remove_if(slots_.begin(), slots_.end(), [] (Slot const & slot) {
+				return slot.session.expired();
+			}), slots_.end());
+		}
+		slots_.push_back({session, [] (void * session) {
+			static_cast<Session *>(session)->cancel();
+		}});
+	}
+
+	/// Cancel all connected sessions that are still in progress.
+	/**
+	 * The completion handlers of the cancelled commands are invoked before this function returns.
+	 */
+	void cancel() {
+		// Cancel the newest sessions first, so commands still waiting in the submission queue
+		// are removed before the request IDs of older commands are released to them.
+		std::vector<Slot> slots = std::exchange(slots_, {});
+		for (auto slot = slots.rbegin(); slot != slots.rend(); ++slot) {
+			if (std::shared_ptr<void> session = slot->session.lock()) slot->cancel(session.get());
+		}
+	}
+};
+
+/// Completion handler bound to a cancellation signal.
+template<typename Handler>
+struct CancellableHandler {
+	CancellationSignal * signal;
+	Handler handler;
+
+	template<typename... Args>
+	void operator() (Args && ... args) {
+		std::move(handler)(std::forward<Args>(args)...);
+	}
+};
+
+/// Bind a completion handler to a cancellation signal.
+/**
+ * The command started with the returned handler is connected to the signal.
+ * The wrapper is removed again when the command is started,
+ * so the associated allocator and executor of the wrapped handler are still used.
+ *
+ * Only completion handlers can be bound, not completion tokens like asio::use_future.
+ */
+template<typename Handler>
+CancellableHandler<std::decay_t<Handler>> bindCancellation(CancellationSignal & signal, Handler && handler) {
+	return {&signal, std::forward<Handler>(handler)};
+}
+
+namespace impl {
+	template<typename Handler> struct is_cancellable_handler                              : std::false_type {};
+	template<typename Handler> struct is_cancellable_handler<CancellableHandler<Handler>> : std::true_type  {};
+}
+
+}}}
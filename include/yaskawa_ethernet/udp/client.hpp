@@ -29,49 +29,283 @@
 #pragma once
 #include "../commands.hpp"
 #include "../error.hpp"
+#include "../small_function.hpp"
 #include "../types.hpp"
+#include "cancellation.hpp"
 #include "message.hpp"
+#include "prepared_command.hpp"
+#include "receive_buffer.hpp"
+#include "retry_policy.hpp"
 
+#include <asio/async_result.hpp>
 #include <asio/io_service.hpp>
 #include <asio/ip/udp.hpp>
+#include <asio/buffer.hpp>
+#include <asio/steady_timer.hpp>
 #include <asio/streambuf.hpp>
 
 #include <estd/result.hpp>
 
+#include <array>
 #include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <deque>
 #include <functional>
-#include <map>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
 
 namespace dr {
 namespace yaskawa {
 namespace udp {
 
+/// Tag type to send a command with a timeout derived from the measured round trip time.
+/**
+ * See Client::retransmissionTimeout().
+ */
+struct AdaptiveTimeout {};
+
+/// Tag value to send a command with a timeout derived from the measured round trip time.
+constexpr AdaptiveTimeout adaptive_timeout{};
+
+/// Tag type to send multiple commands and keep the results of the commands that succeeded.
+/**
+ * See Client::sendCommands().
+ */
+struct PartialResults {};
+
+/// Tag value to send multiple commands and keep the results of the commands that succeeded.
+constexpr PartialResults partial_results{};
+
+namespace impl {
+	template<typename Commands, bool Partial = false> class MultiCommandSession;
+}
+
+template<typename Commands>
+using MultiCommandResult = typename impl::MultiCommandSession<std::decay_t<Commands>>::result_type;
+template<typename Commands>
+using MultiCommandResponse = typename impl::MultiCommandSession<std::decay_t<Commands>>::response_type;
+
+/// Result of sending multiple commands in partial mode: a tuple with a Result for each command.
+template<typename Commands>
+using PartialCommandResult = typename impl::MultiCommandSession<std::decay_t<Commands>, true>::result_type;
+template<typename Commands>
+using PartialCommandResponse = typename impl::MultiCommandSession<std::decay_t<Commands>, true>::response_type;
+
+/// Return type of an asynchronous operation that completes with a Result<Response>, for a given completion token.
+template<typename CompletionToken, typename Response>
+using AsyncResult = typename asio::async_result<std::decay_t<CompletionToken>, void (Result<Response>)>::return_type;
+
 class Client {
 public:
 	using Socket   = asio::ip::udp::socket;
 	using ErrorCallback = std::function<void (Error error)>;
 
+	/// Handler for replies to a request.
+	/**
+	 * The data points into the receive buffer, which is reused once the handler returns.
+	 * A handler can keep the data without copying it by keeping a copy of the buffer handle.
+	 *
+	 * Small handlers (such as a lambda capturing a pointer and a shared_ptr) are stored inline,
+	 * so registering a handler does not allocate.
+	 */
+	using ReplyHandler = SmallFunction<void (ResponseHeader const & header, std::string_view data, ReceiveBuffer const & buffer)>;
+
+	/// Callback invoked with a reserved request ID.
+	using IdCallback = SmallFunction<void (std::uint8_t request_id)>;
+
+	/// Callback for the result of a variable batch.
+	using VarBatchCallback = std::function<void (Result<std::vector<VarValue>>)>;
+
+	/// Callback for the results of a batch of commands.
+	using BatchCallback = std::function<void (Result<std::vector<AnyResponse>>)>;
+
+	/// Callback invoked when sending a message failed.
+	using SendErrorCallback = SmallFunction<void (std::error_code error)>;
+
+	/// Token for a message waiting in the send queue (0 if the message was not queued).
+	using SendToken = std::uint64_t;
+
+	/// Token for a request waiting in the submission queue (0 if the request is not queued).
+	using QueueToken = std::uint64_t;
+
+	/// Callback invoked when a deadline expires.
+	using DeadlineCallback = SmallFunction<void ()>;
+
+	/// Token identifying a scheduled deadline (0 if no deadline is scheduled).
+	using DeadlineToken = std::uint64_t;
+
+	/// Slot in the request table.
 	struct OpenRequest {
 		std::chrono::steady_clock::time_point start_time;
-		std::function<void (ResponseHeader const & header, std::string_view data)> on_reply;
+		ReplyHandler on_reply;
+
+		/// Incremented every time a handler is registered for the slot.
+		std::uint32_t generation = 0;
+
+		/// True if the request ID is allocated.
+		bool allocated = false;
+
+		/// True if a handler is registered for the slot.
+		bool active = false;
+
+		/// True if a reply has been received for the request.
+		bool answered = false;
+
+		/// True if the request was reported lost (possibly resent), so the reply is no valid round trip time sample.
+		bool lost = false;
 	};
 
-	using HandlerToken = std::map<std::uint8_t, OpenRequest>::iterator;
+	/// Token identifying a registered handler.
+	/**
+	 * The generation is used to make sure a stale token can not remove
+	 * a newer handler that was registered for the same request ID.
+	 */
+	struct HandlerToken {
+		std::uint8_t request_id = 0;
+		std::uint32_t generation = 0;
+	};
 
 	ErrorCallback on_error;
 
 private:
+	/// Request waiting in the submission queue for a free request ID.
+	struct QueuedRequest {
+		QueueToken token;
+		IdCallback on_id;
+	};
+
+	/// Buffers for receiving multiple datagrams with a single system call.
+	struct BatchReceiver;
+
+	/// Message waiting to be sent in batch send mode.
+	struct PendingSend {
+		SendToken token;
+		asio::const_buffer data;
+		SendErrorCallback on_error;
+
+		/// True if the message was cancelled while waiting, so the data may no longer be valid.
+		bool cancelled = false;
+	};
+
+	/// Slot for a scheduled deadline.
+	struct Deadline {
+		std::chrono::steady_clock::time_point time;
+		DeadlineCallback on_expire;
+
+		/// Incremented every time the slot is released, to invalidate old tokens.
+		std::uint32_t generation = 0;
+
+		/// Position of the slot in the deadline heap.
+		std::size_t heap_index = 0;
+	};
+
 	Socket socket_;
-	std::uint8_t request_id_ = 1;
-	std::unique_ptr<std::array<std::uint8_t, 512>> read_buffer_;
 
-	std::map<std::uint8_t, OpenRequest> requests_;
+	/// Pool of receive buffers, shared with handlers that keep received data.
+	ReceiveBufferPool receive_buffers_;
+
+	/// Buffer for the next receive operation.
+	ReceiveBuffer read_buffer_;
+
+	/// Buffers for batch receive mode (null if batch receive mode is disabled).
+	std::unique_ptr<BatchReceiver> batch_receiver_;
+
+	/// If true, messages are collected and sent together with sendmmsg().
+	bool batch_send_ = false;
+
+	/// Messages waiting to be sent in batch send mode, ordered by token.
+	std::vector<PendingSend> send_queue_;
+	SendToken next_send_token_ = 1;
+
+	/// True if a flush of the send queue is scheduled or in progress.
+	bool flush_scheduled_ = false;
+
+	/// Timer to defer a flush of the send queue until the current handler returns.
+	/**
+	 * A wait on an expired timer is used instead of posting the flush,
+	 * so the pending flush is aborted when the client is destroyed.
+	 */
+	asio::steady_timer flush_timer_;
+
+	/// Table of open requests, indexed by request ID.
+	std::array<OpenRequest, 256> requests_;
+
+	/// Ring buffer of free request IDs, in the order they were released.
+	/**
+	 * Request ID 0 is never used.
+	 */
+	std::array<std::uint8_t, 255> free_ids_;
+	std::size_t free_ids_start_ = 0;
+	std::size_t free_ids_count_ = 0;
+
+	/// Requests waiting for a free request ID, ordered by token.
+	std::deque<QueuedRequest> queue_;
+	std::size_t max_queue_size_ = 1024;
+	QueueToken next_queue_token_ = 1;
+
+	/// Maximum number of requests in flight.
+	std::size_t max_in_flight_ = 255;
+
+	/// Current in-flight window (equal to max_in_flight_ unless the window is adaptive).
+	double window_ = 255;
+
+	/// If true, the window is adjusted automatically based on loss and round trip time.
+	bool adaptive_window_ = false;
+
+	/// Window threshold between slow start and congestion avoidance.
+	double window_threshold_ = 255;
+
+	/// Lowest round trip time seen so far.
+	std::chrono::steady_clock::duration min_rtt_ = std::chrono::steady_clock::duration::zero();
+
+	/// Time the window was last decreased because of a lost request.
+	std::chrono::steady_clock::time_point last_window_decrease_;
+
+	/// Smoothed round trip time (zero until the first sample).
+	std::chrono::steady_clock::duration smoothed_rtt_ = std::chrono::steady_clock::duration::zero();
+
+	/// Smoothed mean deviation of the round trip time.
+	std::chrono::steady_clock::duration rtt_variation_ = std::chrono::steady_clock::duration::zero();
+
+	/// Number of times the retransmission timeout was doubled since the last valid sample.
+	int rtt_backoff_ = 0;
+
+	/// Time the retransmission timeout was last doubled.
+	std::chrono::steady_clock::time_point last_rtt_backoff_;
+
+	/// Lower and upper bound for the retransmission timeout.
+	std::chrono::steady_clock::duration min_adaptive_timeout_ = std::chrono::milliseconds(10);
+	std::chrono::steady_clock::duration max_adaptive_timeout_ = std::chrono::seconds(1);
+
+	/// Retry policy for commands sent without an explicit policy.
+	RetryPolicy default_retry_policy_;
+
+	/// Deadline slots, indexed by the lower half of a DeadlineToken.
+	std::vector<Deadline> deadlines_;
+
+	/// Released deadline slots.
+	std::vector<std::uint32_t> free_deadlines_;
+
+	/// Binary min-heap of scheduled deadline slots, ordered by deadline.
+	std::vector<std::uint32_t> deadline_heap_;
+
+	/// Single timer for the earliest deadline.
+	asio::steady_timer deadline_timer_;
+
+	/// Expiry time of the pending wait on the deadline timer (max() if no wait is pending).
+	std::chrono::steady_clock::time_point deadline_timer_expiry_ = std::chrono::steady_clock::time_point::max();
+
+	/// Incremented every time the deadline timer is rearmed, to ignore completions of older waits.
+	std::uint64_t deadline_timer_generation_ = 0;
 
 public:
 	Client(asio::io_service & ios);
+	~Client();
 
 	/// Open a connection.
 	void connect(
@@ -92,6 +326,60 @@ public:
 	/// Close the connection.
 	void close();
 
+	/// Get the pool of receive buffers.
+	ReceiveBufferPool const & receiveBuffers() const { return receive_buffers_; }
+
+	/// Check if batch receive mode is enabled.
+	bool batchReceive() const { return batch_receiver_ != nullptr; }
+
+	/// Enable or disable batch receive mode.
+	/**
+	 * In batch receive mode, the client waits for the socket to become readable
+	 * and then reads all queued datagrams with as few recvmmsg() calls as possible.
+	 * This reduces the number of system calls and completion handlers when replies arrive in bursts.
+	 *
+	 * Batch receive mode is only supported on Linux.
+	 * On other platforms, this function does nothing.
+	 *
+	 * The mode can only be changed while the client is not connected.
+	 */
+	void setBatchReceive(bool enable);
+
+	/// Check if batch send mode is enabled.
+	bool batchSend() const { return batch_send_; }
+
+	/// Enable or disable batch send mode.
+	/**
+	 * In batch send mode, messages passed to send() are collected until the current handler returns
+	 * and are then sent with as few sendmmsg() calls as possible.
+	 * This reduces the number of system calls and completion handlers when many commands are sent at once,
+	 * for example with sendCommands().
+	 *
+	 * Batch send mode is only supported on Linux.
+	 * On other platforms, this function does nothing.
+	 */
+	void setBatchSend(bool enable);
+
+	/// Send a message to the controller.
+	/**
+	 * The data must remain valid until it has been sent, or until the message is cancelled with cancelSend().
+	 * In batch send mode, sending is deferred until the current handler returns,
+	 * or until the socket becomes writable again.
+	 *
+	 * The callback is only invoked if sending the message failed.
+	 *
+	 * \return a token to cancel the message while it waits in the send queue (0 if it was not queued).
+	 */
+	SendToken send(asio::const_buffer data, SendErrorCallback on_error);
+
+	/// Remove a message from the send queue.
+	/**
+	 * The message is not sent and the error callback is destroyed without being invoked,
+	 * so the data and anything referenced by the callback may be released afterwards.
+	 * Does nothing if the message was already sent.
+	 */
+	void cancelSend(SendToken token);
+
 	/// Get the IO service used by the client.
 	asio::io_service & ios() { return socket_.get_io_service(); }
 
@@ -100,34 +388,299 @@ public:
 	Socket const  & socket() const { return socket_; }
 
 	/// Register a handler for a request id.
-	HandlerToken registerHandler(std::uint8_t request_id, std::function<void(ResponseHeader const &, std::string_view)> handler);
+	/**
+	 * The request ID must have been allocated with allocateId() or reserveId().
+	 *
+	 * \throw std::logic_error if the request ID is not allocated or a handler is already registered for it.
+	 */
+	HandlerToken registerHandler(std::uint8_t request_id, ReplyHandler handler);
 
-	/// Remove a handler for a request id.
+	/// Remove a handler for a request id and release the request ID.
+	/**
+	 * Does nothing if the handler was already removed.
+	 */
 	void removeHandler(HandlerToken);
 
-	/// Alocate a request ID.
-	std::uint8_t allocateId() {
-		return request_id_++;
-	}
+	/// Allocate a free request ID.
+	/**
+	 * Request IDs are handed out in the order they were released,
+	 * to maximize the time before an ID is reused.
+	 *
+	 * The ID is released again by removeHandler() or releaseId().
+	 *
+	 * \return the request ID, or an empty optional if all request IDs are in use.
+	 */
+	std::optional<std::uint8_t> allocateId();
+
+	/// Release an allocated request ID that has no registered handler.
+	void releaseId(std::uint8_t request_id);
+
+	/// Reserve a request ID, waiting in the submission queue if none is free.
+	/**
+	 * If a request ID is free, the callback is invoked immediately.
+	 * Otherwise, the request is queued and the callback is invoked
+	 * as soon as a request ID is released.
+	 *
+	 * \return a token to cancel the queued request (0 if it was not queued),
+	 *         or an error if the submission queue is full.
+	 */
+	Result<QueueToken> reserveId(IdCallback on_id);
+
+	/// Remove a request from the submission queue.
+	/**
+	 * Does nothing if the request is no longer queued.
+	 */
+	void cancelReservation(QueueToken token);
+
+	/// Get the number of requests waiting in the submission queue.
+	std::size_t queueSize() const { return queue_.size(); }
+
+	/// Get the maximum number of requests in the submission queue.
+	std::size_t maxQueueSize() const { return max_queue_size_; }
+
+	/// Set the maximum number of requests in the submission queue.
+	void setMaxQueueSize(std::size_t size) { max_queue_size_ = size; }
+
+	/// Get the number of requests in flight.
+	std::size_t inFlight() const { return free_ids_.size() - free_ids_count_; }
+
+	/// Get the maximum number of requests in flight.
+	std::size_t maxInFlight() const { return max_in_flight_; }
+
+	/// Set the maximum number of requests in flight.
+	/**
+	 * When the limit is reached, new requests wait in the submission queue
+	 * and are sent as replies for earlier requests arrive.
+	 * The limit is clamped to the range [1, 255].
+	 */
+	void setMaxInFlight(std::size_t max_in_flight);
+
+	/// Get the current in-flight window.
+	/**
+	 * This is equal to maxInFlight() unless the window is adaptive.
+	 * The adaptive window grows and shrinks in fractions of a request, so it is rounded to the nearest whole request.
+	 */
+	std::size_t window() const { return std::size_t(std::lround(window_)); }
+
+	/// Check if the in-flight window is adjusted automatically.
+	bool adaptiveWindow() const { return adaptive_window_; }
+
+	/// Enable or disable automatic adjustment of the in-flight window.
+	/**
+	 * The adaptive window starts small and grows as replies arrive, up to maxInFlight().
+	 * It stops growing and slowly shrinks when the round trip time rises above the lowest observed round trip time,
+	 * and it is halved when a request is lost.
+	 */
+	void setAdaptiveWindow(bool enable);
+
+	/// Report that a request was lost.
+	/**
+	 * Used to adjust the adaptive window.
+	 * Does nothing if the handler was already removed or if a reply was received for the request.
+	 */
+	void reportLoss(HandlerToken token);
+
+	/// Get the smoothed round trip time, or zero if no reply has been received yet.
+	std::chrono::steady_clock::duration smoothedRtt() const { return smoothed_rtt_; }
+
+	/// Get the smoothed mean deviation of the round trip time.
+	std::chrono::steady_clock::duration rttVariation() const { return rtt_variation_; }
+
+	/// Get the timeout for a single attempt derived from the measured round trip time.
+	/**
+	 * The timeout is computed like the TCP retransmission timeout (RFC 6298):
+	 * the smoothed round trip time plus four times the mean deviation,
+	 * clamped to [minAdaptiveTimeout(), maxAdaptiveTimeout()].
+	 *
+	 * Before the first round trip time sample, this returns maxAdaptiveTimeout().
+	 * Replies to requests that were reported lost are not used as samples (Karn's algorithm),
+	 * since they can not be matched to a specific transmission.
+	 * Instead, the timeout is doubled for lost requests (at most once per timeout period)
+	 * until a new valid sample arrives.
+	 */
+	std::chrono::steady_clock::duration retransmissionTimeout() const;
+
+	/// Get the lower bound for the adaptive timeout.
+	std::chrono::steady_clock::duration minAdaptiveTimeout() const { return min_adaptive_timeout_; }
+
+	/// Get the upper bound for the adaptive timeout.
+	std::chrono::steady_clock::duration maxAdaptiveTimeout() const { return max_adaptive_timeout_; }
+
+	/// Set the bounds for the adaptive timeout.
+	void setAdaptiveTimeoutLimits(std::chrono::steady_clock::duration min, std::chrono::steady_clock::duration max);
+
+	/// Forget all round trip time samples.
+	void resetRttEstimate();
+
+	/// Update the round trip time estimate with a new sample.
+	/**
+	 * The client calls this for every reply to a request that was not reported lost.
+	 * A valid sample also resets the exponential backoff of the retransmission timeout.
+	 */
+	void updateRttEstimate(std::chrono::steady_clock::duration rtt);
+
+	/// Schedule a callback to be invoked when a deadline expires.
+	/**
+	 * All deadlines share a single timer, ordered in a heap.
+	 * The timer is only rearmed when a deadline is scheduled before the earliest pending deadline,
+	 * so scheduling and cancelling deadlines normally does not touch the reactor at all.
+	 *
+	 * Deadlines that expire at the same time are invoked in unspecified order.
+	 * The callback may schedule and cancel other deadlines.
+	 *
+	 * \return a token to cancel the deadline.
+	 */
+	DeadlineToken scheduleDeadline(std::chrono::steady_clock::time_point time, DeadlineCallback on_expire);
+
+	/// Cancel a scheduled deadline.
+	/**
+	 * The callback is destroyed without being invoked.
+	 * Does nothing if the deadline already expired or was already cancelled.
+	 */
+	void cancelDeadline(DeadlineToken token);
+
+	/// Get the number of scheduled deadlines.
+	std::size_t pendingDeadlines() const { return deadline_heap_.size(); }
+
+	/// Get the retry policy used for commands sent without an explicit policy.
+	RetryPolicy const & defaultRetryPolicy() const { return default_retry_policy_; }
+
+	/// Set the retry policy used for commands sent without an explicit policy.
+	void setDefaultRetryPolicy(RetryPolicy policy) { default_retry_policy_ = policy; }
 
 	/// Send a command.
 	/**
-	 * \return a functor which tries to stop the command as soon as possible when invoked.
+	 * The send functions accept any asio completion token with signature void (Result<Response>):
+	 * a plain callback, asio::use_future, or any other token supported by asio::async_result.
+	 * The associated allocator of the completion handler is used for the internal state of the command,
+	 * and the handler is invoked through its associated executor, which is kept busy until then.
+	 * Handlers without associated allocator use the RecyclingCache.
+	 *
+	 * To be able to abort the command before its deadline, bind the handler to a CancellationSignal with bindCancellation().
+	 */
+	template<typename T, typename CompletionToken>
+	AsyncResult<CompletionToken, typename T::Response> sendCommand(T command, std::chrono::steady_clock::time_point deadline, CompletionToken && token) {
+		return sendCommand(std::move(command), deadline, default_retry_policy_, std::forward<CompletionToken>(token));
+	}
+
+	template<typename T, typename CompletionToken>
+	AsyncResult<CompletionToken, typename T::Response> sendCommand(T command, std::chrono::steady_clock::duration timeout, CompletionToken && token) {
+		return sendCommand(std::move(command), std::chrono::steady_clock::now() + timeout, std::forward<CompletionToken>(token));
+	}
+
+	/// Send a command, resending it according to a retry policy.
+	/**
+	 * The deadline applies to the command as a whole, including all retries.
+	 *
+	 * ReadVars, ReadVarsInto and WriteVars commands with more variables than the controller
+	 * accepts in a single request are split into multiple requests automatically.
+	 * So are odd ranges of more than one B variable: the last variable is sent as a single variable request.
+	 * The callback receives the combined result, or the first error of any of the requests.
+	 * Note that sendCommands() does not split commands.
 	 */
-	template<typename T, typename Callback>
-	void sendCommand(T command, std::chrono::steady_clock::time_point deadline, Callback && callback);
+	template<typename T, typename CompletionToken>
+	AsyncResult<CompletionToken, typename T::Response> sendCommand(T command, std::chrono::steady_clock::time_point deadline, RetryPolicy retry_policy, CompletionToken && token);
 
-	template<typename T, typename Callback>
-	void sendCommand(T command, std::chrono::steady_clock::duration timeout, Callback && callback) {
-		return sendCommand(std::forward<T>(command), std::chrono::steady_clock::now() + timeout, std::forward<Callback>(callback));
+	template<typename T, typename CompletionToken>
+	AsyncResult<CompletionToken, typename T::Response> sendCommand(T command, std::chrono::steady_clock::duration timeout, RetryPolicy retry_policy, CompletionToken && token) {
+		return sendCommand(std::move(command), std::chrono::steady_clock::now() + timeout, retry_policy, std::forward<CompletionToken>(token));
 	}
 
-	template<typename Callback, typename... Commands>
-	void sendCommands(std::tuple<Commands...> commands, std::chrono::steady_clock::time_point deadline, Callback && callback);
+	/// Send a command with an adaptive timeout.
+	/**
+	 * Each attempt times out after retransmissionTimeout(), measured from the moment the command is sent.
+	 * Time spent waiting in the submission queue does not count.
+	 *
+	 * If the retry policy allows it, the command is resent after a timeout.
+	 * Since each timeout is reported as a loss, the timeout backs off exponentially for retries.
+	 * The attempt_timeout of the retry policy is ignored.
+	 */
+	template<typename T, typename CompletionToken>
+	AsyncResult<CompletionToken, typename T::Response> sendCommand(T command, AdaptiveTimeout, RetryPolicy retry_policy, CompletionToken && token);
+
+	template<typename T, typename CompletionToken>
+	AsyncResult<CompletionToken, typename T::Response> sendCommand(T command, AdaptiveTimeout, CompletionToken && token) {
+		return sendCommand(std::move(command), adaptive_timeout, default_retry_policy_, std::forward<CompletionToken>(token));
+	}
+
+	/// Send multiple commands.
+	/**
+	 * Each command is resent according to the default retry policy.
+	 * Like sendCommand(), this accepts any asio completion token.
+	 */
+	template<typename CompletionToken, typename... Commands>
+	AsyncResult<CompletionToken, MultiCommandResponse<std::tuple<Commands...>>> sendCommands(std::tuple<Commands...> commands, std::chrono::steady_clock::time_point deadline, CompletionToken && token);
+
+	template<typename CompletionToken, typename... Commands>
+	AsyncResult<CompletionToken, MultiCommandResponse<std::tuple<Commands...>>> sendCommands(std::tuple<Commands...> commands, std::chrono::steady_clock::duration timeout, CompletionToken && token) {
+		return sendCommands(std::move(commands), std::chrono::steady_clock::now() + timeout, std::forward<CompletionToken>(token));
+	}
+
+	/// Send multiple commands, each with an adaptive timeout.
+	template<typename CompletionToken, typename... Commands>
+	AsyncResult<CompletionToken, MultiCommandResponse<std::tuple<Commands...>>> sendCommands(std::tuple<Commands...> commands, AdaptiveTimeout, CompletionToken && token);
+
+	/// Send multiple commands and keep the results of the commands that succeeded.
+	/**
+	 * Each element of the response is a Result for the corresponding command (Result<void> for writes).
+	 * A failing command does not abort the others.
+	 * If the controller rejects a fused request for adjacent variables,
+	 * the commands in it are sent again one by one, so only the commands that fail on their own get an error.
+	 * When the deadline expires, the commands that did not finish yet get a timeout error,
+	 * and the operation completes with the results that did arrive.
+	 * Likewise, cancelling the operation keeps the results that already arrived.
+	 *
+	 * The operation itself always completes successfully; errors are reported per command.
+	 */
+	template<typename CompletionToken, typename... Commands>
+	AsyncResult<CompletionToken, PartialCommandResponse<std::tuple<Commands...>>> sendCommands(std::tuple<Commands...> commands, std::chrono::steady_clock::time_point deadline, PartialResults, CompletionToken && token);
 
-	template<typename Callback, typename... Commands>
-	void sendCommands(std::tuple<Commands...> commands, std::chrono::steady_clock::duration timeout, Callback && callback) {
-		return sendCommands(std::move(commands), std::chrono::steady_clock::now() + timeout, std::forward<Callback>(callback));
+	template<typename CompletionToken, typename... Commands>
+	AsyncResult<CompletionToken, PartialCommandResponse<std::tuple<Commands...>>> sendCommands(std::tuple<Commands...> commands, std::chrono::steady_clock::duration timeout, PartialResults, CompletionToken && token) {
+		return sendCommands(std::move(commands), std::chrono::steady_clock::now() + timeout, partial_results, std::forward<CompletionToken>(token));
+	}
+
+	/// Send multiple commands with an adaptive timeout and keep the results of the commands that succeeded.
+	template<typename CompletionToken, typename... Commands>
+	AsyncResult<CompletionToken, PartialCommandResponse<std::tuple<Commands...>>> sendCommands(std::tuple<Commands...> commands, AdaptiveTimeout, PartialResults, CompletionToken && token);
+
+	/// Read and write a list of variables that is only known at runtime.
+	/**
+	 * The variables are sorted by type and index, and runs of adjacent variables are merged
+	 * into as few multi-variable requests as fit in the maximum payload size.
+	 * All requests are sent at once and pipelined according to the in-flight window.
+	 * Each request is resent according to the default retry policy.
+	 *
+	 * The result holds one value for each entry in the batch, in the same order.
+	 * For writes, this is the written value.
+	 * If any request fails, the whole batch fails with the first error,
+	 * and the requests that are still running are cancelled before the callback is invoked.
+	 *
+	 * The order in which the requests are handled by the controller is unspecified,
+	 * so a batch should not read and write the same variable, or write the same variable twice.
+	 */
+	void sendVarBatch(std::vector<VarAccess> batch, std::chrono::steady_clock::time_point deadline, VarBatchCallback callback);
+
+	void sendVarBatch(std::vector<VarAccess> batch, std::chrono::steady_clock::duration timeout, VarBatchCallback callback) {
+		return sendVarBatch(std::move(batch), std::chrono::steady_clock::now() + timeout, std::move(callback));
+	}
+
+	/// Send a batch of commands that is only known at runtime.
+	/**
+	 * All commands are sent at once and pipelined according to the in-flight window,
+	 * so they are handled concurrently and in an unspecified order.
+	 * Each command is resent according to the default retry policy,
+	 * and ranges of variables are split as with sendCommand().
+	 * The deadline also applies to file transfers in the batch.
+	 *
+	 * The callback is invoked once, with the responses in the same order as the commands.
+	 * If any command fails, the whole batch fails with the first error,
+	 * and the commands that are still running are cancelled before the callback is invoked.
+	 */
+	void sendBatch(std::vector<AnyCommand> commands, std::chrono::steady_clock::time_point deadline, BatchCallback callback);
+
+	void sendBatch(std::vector<AnyCommand> commands, std::chrono::steady_clock::duration timeout, BatchCallback callback) {
+		return sendBatch(std::move(commands), std::chrono::steady_clock::now() + timeout, std::move(callback));
 	}
 
 	void readFileList(
@@ -137,6 +690,12 @@ public:
 		std::function<void(std::size_t bytes_received)> on_progress
 	);
 
+	/// Read a file from the controller.
+	/**
+	 * Unlike other replies, file data blocks are not kept in their receive buffers.
+	 * Each block is appended to the result as it arrives, so a long transfer does not hold
+	 * a pooled receive buffer per block, and the finished string is handed to the callback without another copy.
+	 */
 	void readFile(
 		std::string name,
 		std::chrono::milliseconds timeout,
@@ -161,35 +720,101 @@ private:
 	/// Called when a connection attempt finishes.
 	void onConnect(Error, ErrorCallback callback);
 
+	/// Hand out free request IDs to queued requests.
+	void drainQueue();
+
+	/// Remove the deadline at a position in the heap and release its slot.
+	DeadlineCallback removeDeadline(std::size_t heap_index);
+
+	/// Move a deadline up or down in the heap until the heap is ordered again.
+	void restoreDeadlineHeap(std::size_t heap_index);
+
+	/// Swap two entries in the deadline heap.
+	void swapDeadlines(std::size_t a, std::size_t b);
+
+	/// Make sure the deadline timer expires at the earliest deadline.
+	void armDeadlineTimer();
+
+	/// Invoke all expired deadlines.
+	void onDeadlineTimer();
+
+	/// Update the adaptive window for a received reply.
+	/**
+	 * Only called for replies to requests that were not reported lost,
+	 * since the round trip time of a resent request is ambiguous.
+	 */
+	void onReply(std::chrono::steady_clock::duration rtt);
+
 	/// Start an asynchronous receive.
 	void receive();
 
 	/// Process incoming messages.
 	void onReceive(std::error_code error, std::size_t message_size);
+
+	/// Schedule a flush of the send queue once the current handler returns.
+	void scheduleFlush();
+
+	/// Send all messages in the send queue.
+	void flushSendQueue();
+
+	/// Read and process all queued messages in batch receive mode.
+	void onReadable(std::error_code error);
+
+	/// Process a single incoming message.
+	void dispatch(ReceiveBuffer const & buffer, std::size_t message_size);
 };
 
 }}}
 
 #include "impl/send_command.hpp"
+#include "impl/send_chunked_command.hpp"
 #include "impl/send_multiple_commands.hpp"
 
 namespace dr {
 namespace yaskawa {
 namespace udp {
 
-template<typename T, typename Callback>
-void Client::sendCommand(T command, std::chrono::steady_clock::time_point deadline, Callback && callback) {
-	impl::sendCommand(*this, std::move(command), deadline, std::forward<Callback>(callback));
+template<typename T, typename CompletionToken>
+AsyncResult<CompletionToken, typename T::Response> Client::sendCommand(T command, std::chrono::steady_clock::time_point deadline, RetryPolicy retry_policy, CompletionToken && token) {
+	asio::async_completion<CompletionToken, void (Result<typename T::Response>)> init{token};
+	impl::startCommand(*this, std::move(command), deadline, retry_policy, false, std::move(init.completion_handler));
+	return init.result.get();
 }
 
-template<typename Callback, typename... Commands>
-void Client::sendCommands(std::tuple<Commands...> commands, std::chrono::steady_clock::time_point deadline, Callback && callback) {
-	impl::sendMultipleCommands(*this, std::move(commands), deadline, std::forward<Callback>(callback));
+template<typename T, typename CompletionToken>
+AsyncResult<CompletionToken, typename T::Response> Client::sendCommand(T command, AdaptiveTimeout, RetryPolicy retry_policy, CompletionToken && token) {
+	// Each attempt times out on its own, so the session as a whole needs no deadline.
+	asio::async_completion<CompletionToken, void (Result<typename T::Response>)> init{token};
+	impl::startCommand(*this, std::move(command), std::chrono::steady_clock::time_point::max(), retry_policy, true, std::move(init.completion_handler));
+	return init.result.get();
 }
 
-template<typename Commands>
-using MultiCommandResult = typename impl::MultiCommandSession<std::decay_t<Commands>>::result_type;
-template<typename Commands>
-using MultiCommandResponse = typename impl::MultiCommandSession<std::decay_t<Commands>>::response_type;
+template<typename CompletionToken, typename... Commands>
+AsyncResult<CompletionToken, MultiCommandResponse<std::tuple<Commands...>>> Client::sendCommands(std::tuple<Commands...> commands, std::chrono::steady_clock::time_point deadline, CompletionToken && token) {
+	asio::async_completion<CompletionToken, void (MultiCommandResult<std::tuple<Commands...>>)> init{token};
+	impl::sendMultipleCommands(*this, std::move(commands), deadline, default_retry_policy_, false, std::move(init.completion_handler));
+	return init.result.get();
+}
+
+template<typename CompletionToken, typename... Commands>
+AsyncResult<CompletionToken, MultiCommandResponse<std::tuple<Commands...>>> Client::sendCommands(std::tuple<Commands...> commands, AdaptiveTimeout, CompletionToken && token) {
+	asio::async_completion<CompletionToken, void (MultiCommandResult<std::tuple<Commands...>>)> init{token};
+	impl::sendMultipleCommands(*this, std::move(commands), std::chrono::steady_clock::time_point::max(), default_retry_policy_, true, std::move(init.completion_handler));
+	return init.result.get();
+}
+
+template<typename CompletionToken, typename... Commands>
+AsyncResult<CompletionToken, PartialCommandResponse<std::tuple<Commands...>>> Client::sendCommands(std::tuple<Commands...> commands, std::chrono::steady_clock::time_point deadline, PartialResults, CompletionToken && token) {
+	asio::async_completion<CompletionToken, void (PartialCommandResult<std::tuple<Commands...>>)> init{token};
+	impl::sendMultipleCommands<true>(*this, std::move(commands), deadline, default_retry_policy_, false, std::move(init.completion_handler));
+	return init.result.get();
+}
+
+template<typename CompletionToken, typename... Commands>
+AsyncResult<CompletionToken, PartialCommandResponse<std::tuple<Commands...>>> Client::sendCommands(std::tuple<Commands...> commands, AdaptiveTimeout, PartialResults, CompletionToken && token) {
+	asio::async_completion<CompletionToken, void (PartialCommandResult<std::tuple<Commands...>>)> init{token};
+	impl::sendMultipleCommands<true>(*this, std::move(commands), std::chrono::steady_clock::time_point::max(), default_retry_policy_, true, std::move(init.completion_handler));
+	return init.result.get();
+}
 
 }}}
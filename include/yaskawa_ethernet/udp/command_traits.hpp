@@ -26,11 +26,13 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#pragma once
 #include "./message.hpp"
 #include "../commands.hpp"
 
 #include <estd/result.hpp>
 
+#include <cstddef>
 #include <type_traits>
 
 namespace dr {
@@ -47,18 +49,23 @@ template<typename T>       struct encoded_size;
 /// The command number for the UDP protocol.
 template<typename Command> struct udp_command;
 
-#define VAR_TRAITS(TYPE, SIZE, SINGLE, MULTI) \
+/// The maximum number of variables the controller accepts in a single plural read or write request.
+template<typename T>       struct max_multiple_count;
+
+#define VAR_TRAITS(TYPE, SIZE, MAX_COUNT, SINGLE, MULTI) \
 template<> struct encoded_size<TYPE> : size_constant<SIZE> {}; \
+template<> struct max_multiple_count<TYPE> : size_constant<MAX_COUNT> {}; \
 template<> struct udp_command<ReadVar<TYPE>>   : command_constant<SINGLE>{}; \
 template<> struct udp_command<WriteVar<TYPE>>  : command_constant<SINGLE>{}; \
 template<> struct udp_command<ReadVars<TYPE>>   : command_constant<MULTI>{}; \
+template<> struct udp_command<ReadVarsInto<TYPE>> : command_constant<MULTI>{}; \
 template<> struct udp_command<WriteVars<TYPE>>  : command_constant<MULTI>{}
 
-VAR_TRAITS(std::uint8_t,      1, commands::robot::readwrite_int8_variable,           commands::robot::readwrite_multiple_int8);
-VAR_TRAITS(std::int16_t,      2, commands::robot::readwrite_int16_variable,          commands::robot::readwrite_multiple_int16);
-VAR_TRAITS(std::int32_t,      4, commands::robot::readwrite_int32_variable,          commands::robot::readwrite_multiple_int32);
-VAR_TRAITS(float,             4, commands::robot::readwrite_float_variable,          commands::robot::readwrite_multiple_float);
-VAR_TRAITS(Position,     13 * 4, commands::robot::readwrite_robot_position_variable, commands::robot::readwrite_multiple_robot_position);
+VAR_TRAITS(std::uint8_t,      1, 474, commands::robot::readwrite_int8_variable,           commands::robot::readwrite_multiple_int8);
+VAR_TRAITS(std::int16_t,      2, 237, commands::robot::readwrite_int16_variable,          commands::robot::readwrite_multiple_int16);
+VAR_TRAITS(std::int32_t,      4, 118, commands::robot::readwrite_int32_variable,          commands::robot::readwrite_multiple_int32);
+VAR_TRAITS(float,             4, 118, commands::robot::readwrite_float_variable,          commands::robot::readwrite_multiple_float);
+VAR_TRAITS(Position,     13 * 4,   9, commands::robot::readwrite_robot_position_variable, commands::robot::readwrite_multiple_robot_position);
 
 /// If true, Command is a multi-part download command.
 template<typename Command> struct is_file_read_command : std::false_type{};
@@ -69,6 +76,40 @@ template<> struct is_file_read_command<ReadFile>      : std::true_type{};
 template<typename Command> struct is_file_write_command : std::false_type{};
 template<> struct is_file_read_command<WriteFile> : std::true_type{};
 
+/// If true, Command can safely be sent more than once.
+/**
+ * Writes are not considered idempotent:
+ * a delayed duplicate could overwrite a value written by a later command.
+ */
+template<typename Command> struct is_idempotent : std::false_type{};
+template<> struct is_idempotent<ReadStatus>          : std::true_type{};
+template<> struct is_idempotent<ReadCurrentPosition> : std::true_type{};
+template<typename T> struct is_idempotent<ReadVar<T>>  : std::true_type{};
+template<typename T> struct is_idempotent<ReadVars<T>> : std::true_type{};
+template<typename T> struct is_idempotent<ReadVarsInto<T>> : std::true_type{};
+
+/// The command that reads or writes a range of variables in one request, for a command on a single variable.
+/**
+ * The type is void for commands that can not be fused.
+ * max_count is the number of variables that fit in a single request.
+ *
+ * B variables are left out, since the controller only accepts an even number of them in a single request.
+ */
+template<typename Command> struct fused_command { using type = void; };
+
+template<typename T> struct fused_command<ReadVar<T>> {
+	using type = ReadVars<T>;
+	static constexpr std::size_t max_count = max_multiple_count<T>::value;
+};
+
+template<typename T> struct fused_command<WriteVar<T>> {
+	using type = WriteVars<T>;
+	static constexpr std::size_t max_count = max_multiple_count<T>::value;
+};
+
+template<> struct fused_command<ReadVar<std::uint8_t>>  { using type = void; };
+template<> struct fused_command<WriteVar<std::uint8_t>> { using type = void; };
+
 /// If true, Command is a multi-part upload or download command.
 template<typename Command> struct is_file_command : bool_constant<false
 	|| is_file_read_command<Command>::value
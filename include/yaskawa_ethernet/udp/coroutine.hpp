@@ -0,0 +1,174 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "../recycling_allocator.hpp"
+#include "client.hpp"
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define DR_YASKAWA_HAS_COROUTINES 1
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+namespace impl {
+/// Awaitable that starts an asynchronous operation when the coroutine suspends and resumes it with the result.
+/**
+ * The completion callback only captures the awaitable and the coroutine handle,
+ * so it fits in the inline storage of the command callbacks and does not allocate.
+ *
+ * The operation must complete asynchronously, which holds for all operations of the Client:
+ * even errors detected before anything is sent are posted to the io_service.
+ * The coroutine is resumed on the thread running the io_service.
+ */
+template<typename Result, typename Start>
+class CallbackAwaitable {
+	Start start_;
+	std::optional<Result> result_;
+
+public:
+	explicit CallbackAwaitable(Start start) : start_(std::move(start)) {}
+
+	// The callback refers to the awaitable, so it must stay where it is.
+	CallbackAwaitable(CallbackAwaitable const &) = delete;
+	CallbackAwaitable & operator=(CallbackAwaitable const &) = delete;
+
+	bool await_ready() const noexcept { return false; }
+
+	void await_suspend(std::coroutine_handle<> handle) {
+		std::move(start_)([this, handle] (Result result) {
+			result_.emplace(std::move(result));
+			handle.resume();
+		});
+	}
+
+	Result await_resume() {
+		return std::move(*result_);
+	}
+};
+
+template<typename Result, typename Start>
+CallbackAwaitable<Result, Start> makeCallbackAwaitable(Start start) {
+	return CallbackAwaitable<Result, Start>{std::move(start)};
+}
+}
+
+/// Send a command and co_await the result.
+/**
+ * The remaining arguments are passed to Client::sendCommand() before the callback,
+ * so any of its timeout and retry policy overloads can be used:
+ * \code
+ * Result<std::int32_t> value = co_await asyncSendCommand(client, ReadInt32Var{7}, 100ms);
+ * \endcode
+ */
+template<typename Command, typename... Args>
+auto asyncSendCommand(Client & client, Command command, Args... args) {
+	return impl::makeCallbackAwaitable<Result<typename Command::Response>>(
+		[&client, command = std::move(command), args...] (auto callback) mutable {
+			client.sendCommand(std::move(command), args..., std::move(callback));
+		}
+	);
+}
+
+/// Send multiple commands and co_await the combined result.
+/**
+ * The remaining arguments are passed to Client::sendCommands() before the callback.
+ * If they include partial_results, the awaited value holds a Result for each command.
+ */
+template<typename... Commands, typename... Args>
+auto asyncSendCommands(Client & client, std::tuple<Commands...> commands, Args... args) {
+	using ResultType = std::conditional_t<(std::is_same<Args, PartialResults>::value || ...),
+		PartialCommandResult<std::tuple<Commands...>>,
+		MultiCommandResult<std::tuple<Commands...>>
+	>;
+	return impl::makeCallbackAwaitable<ResultType>(
+		[&client, commands = std::move(commands), args...] (auto callback) mutable {
+			client.sendCommands(std::move(commands), args..., std::move(callback));
+		}
+	);
+}
+
+/// Read a file from the controller and co_await the contents.
+inline auto asyncReadFile(
+	Client & client,
+	std::string name,
+	std::chrono::milliseconds timeout,
+	std::function<void(std::size_t bytes_received)> on_progress = nullptr
+) {
+	return impl::makeCallbackAwaitable<Result<std::string>>(
+		[&client, name = std::move(name), timeout, on_progress = std::move(on_progress)] (auto callback) mutable {
+			client.readFile(std::move(name), timeout, std::move(callback), std::move(on_progress));
+		}
+	);
+}
+
+/// Write a file to the controller and co_await the result.
+inline auto asyncWriteFile(
+	Client & client,
+	std::string name,
+	std::string data,
+	std::chrono::milliseconds timeout,
+	std::function<void(std::size_t bytes_sent, std::size_t bytes_total)> on_progress = nullptr
+) {
+	return impl::makeCallbackAwaitable<Result<void>>(
+		[&client, name = std::move(name), data = std::move(data), timeout, on_progress = std::move(on_progress)] (auto callback) mutable {
+			client.writeFile(std::move(name), std::move(data), timeout, std::move(callback), std::move(on_progress));
+		}
+	);
+}
+
+/// Base class for coroutine promise types that allocates coroutine frames from the RecyclingCache.
+/**
+ * A coroutine that is started for every sequence of commands can derive its promise type from this class,
+ * so that its frame does not hit the heap after warm-up, just like the command sessions.
+ * Frames larger than the biggest size class of the cache are allocated directly.
+ */
+struct RecyclingFrame {
+	static void * operator new(std::size_t size) {
+		return RecyclingCache::allocate(size);
+	}
+
+	static void operator delete(void * pointer, std::size_t size) noexcept {
+		RecyclingCache::deallocate(pointer, size);
+	}
+};
+
+}}}
+
+#endif
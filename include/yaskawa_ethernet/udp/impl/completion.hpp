@@ -0,0 +1,102 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "../../recycling_allocator.hpp"
+
+#include <asio/associated_allocator.hpp>
+#include <asio/associated_executor.hpp>
+#include <asio/executor_work_guard.hpp>
+#include <asio/system_executor.hpp>
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+namespace impl {
+
+/// Get an allocator for the internal state of an operation from the associated allocator of its completion handler.
+/**
+ * Handlers without an associated allocator get an allocator for the RecyclingCache.
+ */
+template<typename T, typename Handler>
+auto handlerAllocator(Handler const & handler) {
+	using Allocator = asio::associated_allocator_t<Handler, RecyclingAllocator<void>>;
+	using Rebound   = typename std::allocator_traits<Allocator>::template rebind_alloc<T>;
+	return Rebound(asio::get_associated_allocator(handler, RecyclingAllocator<void>{}));
+}
+
+/// Completion handler of an operation, which keeps the associated executor of the handler busy until it is invoked.
+/**
+ * Asio requires outstanding work on the associated executor for the whole operation,
+ * so that io_service::run() does not return early when the handler runs on another io_service or through a strand.
+ * Handlers without associated executor are invoked directly and need no work tracking.
+ */
+template<typename Handler, bool Direct = std::is_same<asio::associated_executor_t<Handler>, asio::system_executor>::value>
+class CompletionHandler {
+	Handler handler_;
+
+public:
+	explicit CompletionHandler(Handler handler) : handler_(std::move(handler)) {}
+
+	/// Invoke the handler with the result of the operation.
+	template<typename Result>
+	void operator() (Result && result) {
+		std::move(handler_)(std::forward<Result>(result));
+	}
+};
+
+template<typename Handler>
+class CompletionHandler<Handler, false> {
+	Handler handler_;
+	asio::executor_work_guard<asio::associated_executor_t<Handler>> work_;
+
+public:
+	explicit CompletionHandler(Handler handler) :
+		handler_(std::move(handler)),
+		work_(asio::get_associated_executor(handler_)) {}
+
+	/// Dispatch the handler to its associated executor with the result of the operation.
+	/**
+	 * The function object passed to the executor hides the associated allocator of the handler,
+	 * so the allocator is passed to the executor explicitly.
+	 */
+	template<typename Result>
+	void operator() (Result && result) {
+		auto allocator = asio::get_associated_allocator(handler_, RecyclingAllocator<void>{});
+		work_.get_executor().dispatch([handler = std::move(handler_), result = std::forward<Result>(result)] () mutable {
+			std::move(handler)(std::move(result));
+		}, allocator);
+		work_.reset();
+	}
+};
+
+}}}}
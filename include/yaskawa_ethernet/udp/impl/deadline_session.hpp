@@ -27,10 +27,10 @@
  */
 
 #pragma once
+#include "../client.hpp"
+
 #include <estd/result.hpp>
 
-#include <asio/io_service.hpp>
-#include <asio/steady_timer.hpp>
 #include <asio/error.hpp>
 
 #include <chrono>
@@ -42,6 +42,11 @@ namespace yaskawa {
 namespace udp {
 namespace impl {
 
+/// Session wrapper that times out the session at a deadline.
+/**
+ * The deadline is registered with the client, which handles all deadlines with a single timer.
+ * The wrapped session is constructed with the client as first argument.
+ */
 template<typename Session>
 class DeadlineSession {
 public:
@@ -49,27 +54,33 @@ public:
 	using result_type = typename Session::result_type;
 
 private:
-	/// Timer to interrupt the work session.
-	asio::steady_timer timer_;
+	Client * client_;
+
+	/// Token for the deadline registered with the client.
+	Client::DeadlineToken deadline_ = 0;
 
 	/// The session doing the real work.
 	Session work_;
 
 public:
 	template<typename ...Args>
-	DeadlineSession(asio::io_service & io_service, Args && ...args) :
-		timer_{io_service},
-		work_(std::forward<Args>(args)...) {}
+	DeadlineSession(Client & client, Args && ...args) :
+		client_{&client},
+		work_(client, std::forward<Args>(args)...) {}
+
+	~DeadlineSession() {
+		cancelTimeout();
+	}
 
 	template<typename ...Args>
 	void start(std::chrono::steady_clock::time_point deadline, Args && ...args) {
 		work_.start(std::forward<Args>(args)...);
 
-		timer_.expires_at(deadline);
-		timer_.async_wait([this] (std::error_code error) {
-			if (error == asio::error::operation_aborted) return;
-			if (error) work_.resolve(estd::error{error, "waiting for timeout"});
-			work_.resolve(estd::error{asio::error::timed_out});
+		// A session without deadline does not need to wait for it.
+		if (deadline == std::chrono::steady_clock::time_point::max()) return;
+		deadline_ = client_->scheduleDeadline(deadline, [this] () {
+			deadline_ = 0;
+			work_.timeout();
 		});
 	}
 
@@ -82,8 +93,13 @@ public:
 		work_.resolve(std::move(result));
 	}
 
+	/// Resolve the session with asio::error::operation_aborted.
+	void cancel() {
+		work_.resolve(Error{asio::error::operation_aborted});
+	}
+
 	void cancelTimeout() {
-		timer_.cancel();
+		client_->cancelDeadline(std::exchange(deadline_, 0));
 	}
 };
 
@@ -0,0 +1,206 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "../../commands.hpp"
+#include "../../error.hpp"
+#include "../../recycling_allocator.hpp"
+#include "../cancellation.hpp"
+#include "../client.hpp"
+#include "../command_traits.hpp"
+#include "../retry_policy.hpp"
+#include "./completion.hpp"
+#include "./send_command.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+namespace impl {
+
+/// Check if a command reads or writes a range of variables that can be split into chunks.
+template<typename Command> struct is_var_range_command                  : std::false_type {};
+template<typename T>       struct is_var_range_command<ReadVars<T>>     : std::true_type  { using value_type = T; };
+template<typename T>       struct is_var_range_command<ReadVarsInto<T>> : std::true_type  { using value_type = T; };
+template<typename T>       struct is_var_range_command<WriteVars<T>>    : std::true_type  { using value_type = T; };
+
+/// Get the number of variables in a range command.
+template<typename T> std::size_t rangeCount(ReadVars<T>     const & command) { return command.count; }
+template<typename T> std::size_t rangeCount(ReadVarsInto<T> const & command) { return command.count; }
+template<typename T> std::size_t rangeCount(WriteVars<T>    const & command) { return command.values.size(); }
+
+/// Check if a range of T variables is an odd range of more than one B variable, which the controller does not accept in a single request.
+template<typename T>
+bool isOddByteRange(std::size_t count) {
+	return std::is_same<T, std::uint8_t>::value && count != 1 && count % 2 != 0;
+}
+
+/// Check if a range command must be split into multiple requests.
+/**
+ * That is the case if it has more variables than the controller accepts in a single request,
+ * or if it is an odd range of B variables.
+ */
+template<typename Command>
+bool needsChunking(Command const & command) {
+	using T = typename is_var_range_command<Command>::value_type;
+	std::size_t count = rangeCount(command);
+	return count > max_multiple_count<T>::value || isOddByteRange<T>(count);
+}
+
+/// Get the chunk of a range command starting at an offset.
+template<typename T>
+ReadVarsInto<T> rangeChunk(ReadVarsInto<T> const & command, std::size_t offset, std::size_t count) {
+	return {std::uint16_t(command.index + offset), std::uint16_t(count), command.output + offset};
+}
+
+template<typename T>
+WriteVars<T> rangeChunk(WriteVars<T> const & command, std::size_t offset, std::size_t count) {
+	auto begin = command.values.begin() + offset;
+	return {std::uint16_t(command.index + offset), std::vector<T>(begin, begin + count)};
+}
+
+/// Shared state of a chunked command.
+template<typename Command, typename Callback>
+struct ChunkedCommandState {
+	using Response = typename Command::Response;
+
+	/// Storage for the values of a chunked ReadVars command.
+	std::conditional_t<std::is_void<Response>::value, char, Response> values;
+
+	std::size_t remaining_chunks;
+	bool done = false;
+	CompletionHandler<Callback> callback;
+
+	/// Signal connected to the sessions of all chunks.
+	CancellationSignal chunks;
+
+	ChunkedCommandState(Callback callback) : callback{std::move(callback)} {}
+
+	void resolve(Result<Response> result) {
+		if (done) return;
+		done = true;
+
+		// Stop the other chunks before the caller is told the command finished,
+		// so they can no longer write into the output of a ReadVarsInto command.
+		chunks.cancel();
+		callback(std::move(result));
+	}
+
+	void chunkDone(Result<void> result) {
+		if (!result) return resolve(result.error_unchecked());
+		if (--remaining_chunks > 0) return;
+		if constexpr (std::is_void<Response>::value) {
+			resolve(estd::in_place_valid);
+		} else {
+			resolve(std::move(values));
+		}
+	}
+};
+
+/// Send a range command as multiple requests that each fit in a single datagram.
+/**
+ * The deadline applies to the command as a whole.
+ * The callback is invoked with the first error reported by any of the chunks,
+ * or with the combined result when all chunks succeeded.
+ *
+ * An odd range of B variables ends in a chunk of a single variable, which is sent as a single variable request.
+ * All other chunks of B variables are even, since the maximum count is even.
+ *
+ * A ReadVars command is sent as ReadVarsInto chunks which decode straight into the final vector.
+ * When one chunk fails, the other chunks are cancelled before the callback is invoked.
+ * If a cancellation signal is given, each chunk is connected to it.
+ */
+template<typename Command, typename Callback>
+void sendChunkedCommand(Client & client, Command command, std::chrono::steady_clock::time_point deadline, RetryPolicy retry_policy, bool adaptive_timeout, Callback callback, CancellationSignal * signal = nullptr) {
+	using T     = typename is_var_range_command<Command>::value_type;
+	using State = ChunkedCommandState<Command, std::decay_t<Callback>>;
+	auto state  = std::allocate_shared<State>(handlerAllocator<State>(callback), std::move(callback));
+
+	std::size_t count     = rangeCount(command);
+	std::size_t max_count = max_multiple_count<T>::value;
+
+	// Split off the last variable of an odd range of B variables, so all other chunks are even.
+	std::size_t multiple_count = isOddByteRange<T>(count) ? count - 1 : count;
+	state->remaining_chunks = (multiple_count + max_count - 1) / max_count + (count - multiple_count);
+
+	// Check the range as a whole, so no chunk is sent if part of the range would be rejected.
+	if (command.index + count > 0x10000) {
+		Error error{std::errc::invalid_argument, "variable range " + std::to_string(command.index) + " + " + std::to_string(count) + " exceeds the highest variable index"};
+		client.ios().post(recycling([state, error = std::move(error)] () mutable { state->resolve(std::move(error)); }));
+		return;
+	}
+
+	if constexpr (std::is_same<Command, ReadVars<T>>::value) state->values.resize(count);
+
+	std::size_t chunk_count = 0;
+	for (std::size_t offset = 0; offset < count; offset += chunk_count) {
+		chunk_count = offset < multiple_count ? std::min(max_count, multiple_count - offset) : count - offset;
+		auto chunk_callback = [state] (Result<void> result) { state->chunkDone(std::move(result)); };
+		if constexpr (std::is_same<Command, ReadVars<T>>::value) {
+			ReadVarsInto<T> chunk{std::uint16_t(command.index + offset), std::uint16_t(chunk_count), state->values.data() + offset};
+			auto session = sendCommand(client, chunk, deadline, retry_policy, adaptive_timeout, std::move(chunk_callback));
+			state->chunks.connect(session);
+			if (signal) signal->connect(session);
+		} else {
+			auto session = sendCommand(client, rangeChunk(command, offset, chunk_count), deadline, retry_policy, adaptive_timeout, std::move(chunk_callback));
+			state->chunks.connect(session);
+			if (signal) signal->connect(session);
+		}
+	}
+}
+
+/// Send a command, splitting ranges of variables that do not fit in a single request.
+/**
+ * Handlers bound to a cancellation signal are unwrapped, and the sessions are connected to the signal.
+ */
+template<typename Command, typename Callback>
+void startCommand(Client & client, Command command, std::chrono::steady_clock::time_point deadline, RetryPolicy retry_policy, bool adaptive_timeout, Callback callback, CancellationSignal * signal = nullptr) {
+	if constexpr (is_cancellable_handler<Callback>::value) {
+		return startCommand(client, std::move(command), deadline, retry_policy, adaptive_timeout, std::move(callback.handler), callback.signal);
+	} else {
+		if constexpr (is_var_range_command<Command>::value) {
+			if (needsChunking(command)) {
+				return sendChunkedCommand(client, std::move(command), deadline, retry_policy, adaptive_timeout, std::move(callback), signal);
+			}
+		}
+		auto session = sendCommand(client, std::move(command), deadline, retry_policy, adaptive_timeout, std::move(callback));
+		if (signal) signal->connect(session);
+	}
+}
+
+}}}}
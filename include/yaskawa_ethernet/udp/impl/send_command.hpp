@@ -28,14 +28,19 @@
 
 #pragma once
 #include "../../error.hpp"
+#include "../../recycling_allocator.hpp"
+#include "../../small_function.hpp"
 #include "../client.hpp"
+#include "../command_traits.hpp"
 #include "../protocol.hpp"
+#include "../retry_policy.hpp"
+#include "./completion.hpp"
 #include "./deadline_session.hpp"
 
-#include <asio/steady_timer.hpp>
 #include <asio/buffer.hpp>
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <memory>
@@ -52,11 +57,18 @@ namespace impl {
 /// Session to send a command and parse the result.
 /**
  * The session consists of the following actions:
- * - Write command and data.
+ * - Reserve a request ID (possibly waiting in the submission queue of the client).
+ * - Write command and data (and resend it according to the retry policy).
  * - Read command response.
  * - Read response data.
  *
- * It does not support timeouts directly, but it does have a cancel() method.
+ * It does not support overall timeouts directly, but it does have a cancel() method.
+ * Individual attempts time out according to the retry policy,
+ * or according to the round trip time estimate of the client in adaptive timeout mode.
+ *
+ * After warm-up, the session does not allocate:
+ * the encode buffer is recycled, asynchronous operations are allocated from the RecyclingCache
+ * and attempt timeouts are registered with the deadline heap of the client.
  */
 template<typename Command>
 class CommandSession {
@@ -64,44 +76,127 @@ public:
 	/// Type passed to the callback.
 	using result_type = Result<typename Command::Response>;
 
+	/// Callback for the result, with room for a shared_ptr and a few captured pointers.
+	using Callback = SmallFunction<void (result_type), 8 * sizeof(void *)>;
+
 private:
 	Client * client_;
-	std::uint8_t request_id_;
+	std::uint8_t request_id_ = 0;
 	Command command_;
-	std::function<void(result_type)> callback_;
+	Callback callback_;
 
+	Client::QueueToken queued_ = 0;
 	Client::HandlerToken handler_;
+	Client::SendToken sending_ = 0;
 	std::vector<std::uint8_t> write_buffer_;
 
+	RetryPolicy retry_policy_;
+	bool adaptive_timeout_;
+	Client::DeadlineToken attempt_deadline_ = 0;
+	int retries_ = 0;
+
 	std::atomic_flag started_ = ATOMIC_FLAG_INIT;
-	std::atomic_flag done_    = ATOMIC_FLAG_INIT;
+	std::atomic_bool done_{false};
 
 public:
 	/// Construct a command session.
-	CommandSession(Client & client, Command command) :
+	CommandSession(Client & client, Command command, RetryPolicy retry_policy = {}, bool adaptive_timeout = false) :
 		client_{&client},
-		request_id_{client.allocateId()},
-		command_{std::move(command)}
-	{
-		// Encode the command.
-		encode(write_buffer_, request_id_, command_);
-	}
+		command_{std::move(command)},
+		retry_policy_{retry_policy},
+		adaptive_timeout_{adaptive_timeout} {}
 
 	// Delete copy and move constructors, since we've posted callbacks with our address.
 	CommandSession(CommandSession const &) = delete;
 	CommandSession(CommandSession      &&) = delete;
 
+	~CommandSession() {
+		client_->cancelDeadline(attempt_deadline_);
+		client_->cancelSend(sending_);
+		BufferCache::recycle(std::move(write_buffer_));
+	}
+
 	/// Start the session.
 	/**
 	 * By delaying start and taking the callback here,
 	 * the callback can contain a shared pointer to keep ourselves alive.
 	 */
-	void start(std::function<void(result_type)> callback) {
+	void start(Callback callback) {
 		if (started_.test_and_set()) throw std::logic_error("CommandSession::start: session already started");
 		callback_ = std::move(callback);
 
+		// Reject invalid commands asynchronously, like any other error.
+		if (Error error = validate(command_)) {
+			client_->ios().post(recycling([this, error = std::move(error)] () mutable {
+				resolve(std::move(error));
+			}));
+			return;
+		}
+
+		// Reserve a request ID, or wait in the submission queue for one.
+		Result<Client::QueueToken> queued = client_->reserveId([this] (std::uint8_t request_id) {
+			queued_ = 0;
+			send(request_id);
+		});
+
+		// Report a full queue asynchronously, like any other error.
+		if (!queued) {
+			client_->ios().post(recycling([this, error = std::move(queued.error_unchecked())] () mutable {
+				resolve(std::move(error));
+			}));
+			return;
+		}
+		// The token is 0 if the request ID was granted immediately.
+		queued_ = *queued;
+	}
+
+	/// Get the command sent by the session.
+	Command const & command() const { return command_; }
+
+	/// Report the request as lost to the client.
+	void reportLoss() {
+		client_->reportLoss(handler_);
+	}
+
+	/// Resolve the session with a timeout error.
+	void timeout() {
+		reportLoss();
+		resolve(Error{asio::error::timed_out});
+	}
+
+	void resolve(result_type result) {
+		if (done_.exchange(true)) return;
+		client_->cancelDeadline(std::exchange(attempt_deadline_, 0));
+		client_->cancelReservation(queued_);
+		client_->cancelSend(std::exchange(sending_, 0));
+		client_->removeHandler(handler_);
+		callback_(std::move(result));
+	}
+
+private:
+	/// Check if the command may be resent after the current attempt.
+	bool canRetry() const {
+		if (retries_ >= retry_policy_.max_retries) return false;
+		if (!adaptive_timeout_ && retry_policy_.attempt_timeout.count() <= 0) return false;
+		return is_idempotent<Command>::value || retry_policy_.retry_non_idempotent;
+	}
+
+	/// Get the time to wait for a reply to the current attempt.
+	std::chrono::steady_clock::duration attemptTimeout() const {
+		if (!adaptive_timeout_) return retry_policy_.attempt_timeout;
+		return client_->retransmissionTimeout();
+	}
+
+	/// Encode and send the command once we have a request ID.
+	void send(std::uint8_t request_id) {
+		request_id_ = request_id;
+
+		// Encode the command, reusing the capacity of a recycled buffer.
+		write_buffer_ = BufferCache::take();
+		encode(write_buffer_, request_id_, command_);
+
 		// Register the response handler.
-		handler_ = client_->registerHandler(request_id_, [this] (ResponseHeader const & header, std::string_view data) {
+		handler_ = client_->registerHandler(request_id_, [this] (ResponseHeader const & header, std::string_view data, ReceiveBuffer const &) {
 			if (header.status != 0) {
 				resolve(commandFailed(header.status, header.extra_status));
 			} else {
@@ -109,16 +204,29 @@ public:
 			}
 		});
 
-		// Write the command.
-		client_->socket().async_send(asio::buffer(write_buffer_.data(), write_buffer_.size()), [this] (std::error_code error, std::size_t) {
-			if (error) resolve(Error{error, "writing command for request " + std::to_string(request_id_)});
-		});
+		write();
 	}
 
-	void resolve(result_type result) {
-		if (done_.test_and_set()) return;
-		client_->removeHandler(handler_);
-		callback_(result);
+	/// Write the encoded command and wait for the attempt to time out if needed.
+	void write() {
+		// The send queue refers to the write buffer, so the message must not outlive the session.
+		// A resend replaces the previous copy if that is still waiting in the queue.
+		client_->cancelSend(sending_);
+		sending_ = client_->send(asio::buffer(write_buffer_.data(), write_buffer_.size()), [this] (std::error_code error) {
+			sending_ = 0;
+			resolve(Error{error, "writing command for request " + std::to_string(request_id_)});
+		});
+
+		bool retry = canRetry();
+		if (!retry && !adaptive_timeout_) return;
+		attempt_deadline_ = client_->scheduleDeadline(std::chrono::steady_clock::now() + attemptTimeout(), [this, retry] () {
+			attempt_deadline_ = 0;
+			if (done_) return;
+			if (!retry) return timeout();
+			reportLoss();
+			++retries_;
+			write();
+		});
 	}
 };
 
@@ -127,21 +235,24 @@ public:
  * The shared_ptr will be held internally by the session until it is ready to be destroyed,
  * so you do not need to keep your own copy alive.
  *
+ * The session is allocated with the associated allocator of the callback,
+ * and the callback is invoked through its associated executor, which is kept busy until then.
+ *
  * \returns a shared_ptr to the created session.
  */
 template<typename Command, typename Callback>
-auto sendCommand(Client & client, Command command, std::chrono::steady_clock::time_point deadline, Callback callback) {
+auto sendCommand(Client & client, Command command, std::chrono::steady_clock::time_point deadline, RetryPolicy retry_policy, bool adaptive_timeout, Callback callback) {
 	using Session = DeadlineSession<CommandSession<std::decay_t<Command>>>;
-	auto session = std::make_shared<Session>(client.ios(), client, std::move(command));
-	session->start(deadline, [&client, session, callback = std::move(callback)] (typename Session::result_type && result) mutable {
+	auto session = std::allocate_shared<Session>(handlerAllocator<Session>(callback), client, std::move(command), retry_policy, adaptive_timeout);
+	session->start(deadline, [&client, session, callback = CompletionHandler<Callback>{std::move(callback)}] (typename Session::result_type && result) mutable {
 		session->cancelTimeout();
-		std::move(callback)(std::move(result));
+		callback(std::move(result));
 
 		// Move the shared_ptr into a posted handler which resets it.
 		// That way, any queued event handlers can still completer succesfully.
-		client.ios().post([session = std::move(session)] () mutable {
+		client.ios().post(recycling([session = std::move(session)] () mutable {
 			session.reset();
-		});
+		}));
 
 		// Reset our own shared_ptr.
 		// Not really needed since we've moved out of it,
@@ -27,10 +27,16 @@
  */
 
 #pragma once
+#include "./completion.hpp"
 #include "./send_command.hpp"
+#include "../cancellation.hpp"
 #include "./deadline_session.hpp"
+#include "../../small_function.hpp"
+#include "../../error.hpp"
 #include "../../type_traits.hpp"
+#include "../command_traits.hpp"
 
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <cstdint>
@@ -39,6 +45,7 @@
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 namespace dr {
 namespace yaskawa {
@@ -46,14 +53,72 @@ namespace udp {
 
 namespace impl {
 
-template<typename Commands>
+/// Fused command type for command I of a tuple, or void if the command can not be fused.
+template<typename Commands, std::size_t I>
+using fused_command_t = typename fused_command<std::tuple_element_t<I, Commands>>::type;
+
+/// Check if command I of a tuple can be fused with the command before it, if their indices turn out to be adjacent.
+template<typename Commands, std::size_t I>
+constexpr bool fusable_with_previous() {
+	if constexpr (I == 0 || I >= std::tuple_size<Commands>::value) {
+		return false;
+	} else {
+		using Previous = std::tuple_element_t<I - 1, Commands>;
+		using Command  = std::tuple_element_t<I, Commands>;
+		return !std::is_void<fused_command_t<Commands, I>>::value && std::is_same<Previous, Command>::value;
+	}
+}
+
+/// Check if command I of a tuple can be fused with one of its neighbours.
+template<typename Commands, std::size_t I>
+constexpr bool fusable() {
+	return fusable_with_previous<Commands, I>() || fusable_with_previous<Commands, I + 1>();
+}
+
+/// Map index I of a command tuple to an std::optional<CommandSession<...>> for a fused command starting at I (or Empty if command I can not be fused).
+template<typename Commands, std::size_t I, bool = fusable<Commands, I>()>
+struct fused_session_element {
+	using type = Empty;
+};
+
+template<typename Commands, std::size_t I>
+struct fused_session_element<Commands, I, true> {
+	using type = std::optional<CommandSession<fused_command_t<Commands, I>>>;
+};
+
+/// Session to send multiple commands and collect the results in a tuple.
+/**
+ * Runs of ReadVar or WriteVar commands for the same variable type are found at compile time.
+ * If the variable indices in such a run turn out to be adjacent,
+ * the run is sent as a single ReadVars or WriteVars command and the results are split again.
+ *
+ * By default, the session fails as a whole as soon as one command fails.
+ * In partial mode, each element of the response is a Result of its own.
+ * A failing command does not stop the others, and when the session times out or is cancelled,
+ * the commands that did not finish yet get the error while the results that did arrive are kept.
+ * If the controller rejects a fused command in partial mode, the commands in it are sent again one by one,
+ * so a single bad variable does not fail its neighbours.
+ */
+template<typename Commands, bool Partial>
 class MultiCommandSession {
 	constexpr static int Count = std::tuple_size<Commands>::value;
 
-	/// Map a Command to the result_type (or Empty for void results).
+	/// Map a Command to the response tuple element (Empty for void results, or a Result in partial mode).
 	template<typename Command>
 	struct response_tuple_element {
-		using type = map_type_t<typename Command::Response, void, Empty>;
+		using type = std::conditional_t<Partial,
+			Result<typename Command::Response>,
+			map_type_t<typename Command::Response, void, Empty>
+		>;
+	};
+
+	/// Map a Command to the storage for its result, which is filled in when the command finishes in partial mode.
+	template<typename Command>
+	struct storage_tuple_element {
+		using type = std::conditional_t<Partial,
+			std::optional<Result<typename Command::Response>>,
+			typename response_tuple_element<Command>::type
+		>;
 	};
 
 	/// Map a Command to an std::optional<CommandSession<Command>>.
@@ -62,32 +127,60 @@ class MultiCommandSession {
 		using type = std::optional<CommandSession<Command>>;
 	};
 
+	/// Map index I to an std::optional<CommandSession<...>> for a fused command starting at I.
+	template<std::size_t I>
+	using fused_session_tuple_element = fused_session_element<Commands, I>;
+
 	using CommandSessionsTuple = map_tuple_t<Commands, command_session_tuple_element>;
+	using FusedSessionsTuple   = index_tuple_t<Count, fused_session_tuple_element>;
+	using StorageTuple         = map_tuple_t<Commands, storage_tuple_element>;
 
 public:
 	using response_type  = map_tuple_t<Commands, response_tuple_element>;
 	using result_type    = Result<response_type>;
 
+	/// Callback for the result, with room for a shared_ptr and a few captured pointers.
+	using Callback = SmallFunction<void (result_type), 8 * sizeof(void *)>;
+
 private:
 	/// Sub-sessions.
 	CommandSessionsTuple sessions_;
 
+	/// Sub-sessions for fused commands, indexed by the first fused command.
+	FusedSessionsTuple fused_sessions_;
+
+	/// Number of commands sent by the sub-session starting at each command (0 if the command is part of an earlier fused command).
+	std::array<std::size_t, Count> fused_length_;
+
 	/// Result storage.
-	response_type result_;
+	StorageTuple result_;
+
+	/// Settings to send the commands of a rejected fused command again, in partial mode.
+	Client * client_;
+	RetryPolicy retry_policy_;
+	bool adaptive_timeout_;
+
+	/// True once the session is resolved and the sub-sessions are being stopped.
+	bool stopping_ = false;
 
 	std::atomic_flag started_ = ATOMIC_FLAG_INIT;
 	std::atomic_flag done_    = ATOMIC_FLAG_INIT;
 
 	std::atomic<int> finished_commands_{0};
-	std::function<void(result_type)> callback_;
+	Callback callback_;
 
 public:
-	MultiCommandSession(Client & client, Commands && commands) {
-		init_sessions_<0>(client, std::move(commands));
+	MultiCommandSession(Client & client, Commands && commands, RetryPolicy retry_policy = {}, bool adaptive_timeout = false) :
+		client_{&client},
+		retry_policy_{retry_policy},
+		adaptive_timeout_{adaptive_timeout}
+	{
+		plan_fusion_<0>(commands, 0);
+		init_sessions_<0>(client, std::move(commands), retry_policy, adaptive_timeout);
 	}
 
 public:
-	void start(std::function<void(result_type)> callback) {
+	void start(Callback callback) {
 		if (started_.test_and_set()) throw std::logic_error("CommandSession::start: session already started");
 		callback_ = std::move(callback);
 		start_sessions_<0>();
@@ -99,17 +192,57 @@ public:
 		using Response = typename std::tuple_element_t<I, Commands>::Response;
 
 		return [this] (Result<Response> result) {
-			if (!result) return resolve(result.error_unchecked());
-			if constexpr (std::is_same<Response, void>() == false) {
-				std::get<I>(result_) = std::move(*result);
+			if constexpr (Partial) {
+				std::get<I>(result_).emplace(std::move(result));
+			} else {
+				if (!result) return resolve(result.error_unchecked());
+				if constexpr (std::is_same<Response, void>() == false) {
+					std::get<I>(result_) = std::move(*result);
+				}
 			}
 			if (++finished_commands_ == Count) resolve(Error{});
 		};
 	}
 
+	/// Get the callback for the fused command starting at command I.
+	template<std::size_t I>
+	auto fusedCallback() {
+		using Response = typename fused_command_t<Commands, I>::Response;
+
+		return [this] (Result<Response> result) {
+			if (!result) {
+				if constexpr (!Partial) {
+					return resolve(result.error_unchecked());
+				} else {
+					// Only a rejected request can be caused by a single command, other errors affect all of them the same way.
+					if (!stopping_ && result.error_unchecked().code() == make_error_code(errc::command_failed)) {
+						return resend_separately_<I, I>(I + fused_length_[I]);
+					}
+					fail_results_<I>(I + fused_length_[I], result.error_unchecked());
+				}
+			} else if constexpr (std::is_same<Response, void>() == false) {
+				split_result_<I>(*result, I, I + fused_length_[I]);
+			} else if constexpr (Partial) {
+				confirm_writes_<I, decltype(std::tuple_element_t<I, Commands>::value)>(I + fused_length_[I]);
+			}
+			if ((finished_commands_ += fused_length_[I]) == Count) resolve(Error{});
+		};
+	}
+
+	/// Resolve the session with a timeout error.
+	void timeout() {
+		report_loss_<0>();
+		resolve(Error{asio::error::timed_out});
+	}
+
 	void resolve(Error error) {
 		if (done_.test_and_set()) return;
-		if (error) {
+		stopping_ = true;
+		if constexpr (Partial) {
+			// Unfinished commands store the error as their own result.
+			if (error) stop_sessions_<0>(error);
+			std::move(callback_)(take_results_(std::make_index_sequence<Count>{}));
+		} else if (error) {
 			stop_sessions_<0>(asio::error::operation_aborted);
 			std::move(callback_)(std::move(error));
 		} else {
@@ -118,12 +251,125 @@ public:
 	}
 
 protected:
+	/// Recursively decide which commands to fuse, based on their variable indices.
+	template<std::size_t I>
+	void plan_fusion_(Commands const & commands, std::size_t run_start) {
+		if constexpr (I < Count) {
+			if constexpr (fusable_with_previous<Commands, I>()) {
+				bool adjacent = std::get<I>(commands).index == std::get<I - 1>(commands).index + 1;
+				if (adjacent && fused_length_[run_start] < fused_command<std::tuple_element_t<I, Commands>>::max_count) {
+					fused_length_[I] = 0;
+					++fused_length_[run_start];
+					return plan_fusion_<I + 1>(commands, run_start);
+				}
+			}
+			fused_length_[I] = 1;
+			plan_fusion_<I + 1>(commands, I);
+		}
+	}
+
+	/// Create the fused command for the commands starting at I.
+	template<std::size_t I>
+	auto fuse_(Commands & commands) {
+		using Fused = fused_command_t<Commands, I>;
+		std::uint16_t index = std::get<I>(commands).index;
+		if constexpr (std::is_same<typename Fused::Response, void>::value) {
+			Fused fused{index, {}};
+			fused.values.reserve(fused_length_[I]);
+			collect_values_<I>(commands, I + fused_length_[I], fused.values);
+			return fused;
+		} else {
+			return Fused{index, std::uint16_t(fused_length_[I])};
+		}
+	}
+
+	/// Recursively collect the values of fused write commands in [I, end).
+	template<std::size_t I, typename T>
+	void collect_values_(Commands & commands, std::size_t end, std::vector<T> & values) {
+		if constexpr (I < Count) {
+			if constexpr (std::is_same<std::tuple_element_t<I, Commands>, WriteVar<T>>::value) {
+				if (I >= end) return;
+				values.push_back(std::move(std::get<I>(commands).value));
+				collect_values_<I + 1>(commands, end, values);
+			}
+		}
+	}
+
+	/// Recursively store the values read by a fused command in the results for commands [I, end).
+	template<std::size_t I, typename T>
+	void split_result_(std::vector<T> & values, std::size_t start, std::size_t end) {
+		if constexpr (I < Count) {
+			if constexpr (std::is_same<std::tuple_element_t<I, Commands>, ReadVar<T>>::value) {
+				if (I >= end) return;
+				if constexpr (Partial) {
+					std::get<I>(result_).emplace(std::move(values[I - start]));
+				} else {
+					std::get<I>(result_) = std::move(values[I - start]);
+				}
+				split_result_<I + 1>(values, start, end);
+			}
+		}
+	}
+
+	/// Recursively store an error as the result for commands [I, end), in partial mode.
+	template<std::size_t I>
+	void fail_results_(std::size_t end, Error const & error) {
+		if constexpr (I < Count) {
+			if (I >= end) return;
+			std::get<I>(result_).emplace(error);
+			fail_results_<I + 1>(end, error);
+		}
+	}
+
+	/// Recursively send the commands in [J, end) of the fused command starting at I as separate commands, in partial mode.
+	template<std::size_t I, std::size_t J>
+	void resend_separately_(std::size_t end) {
+		if constexpr (J < Count) {
+			using Command = std::tuple_element_t<J, Commands>;
+			if constexpr (std::is_same<Command, std::tuple_element_t<I, Commands>>::value) {
+				if (J >= end) return;
+				auto const & fused = std::get<I>(fused_sessions_)->command();
+				std::uint16_t index = fused.index + (J - I);
+				if constexpr (std::is_same<typename Command::Response, void>::value) {
+					std::get<J>(sessions_).emplace(*client_, Command{index, fused.values[J - I]}, retry_policy_, adaptive_timeout_);
+				} else {
+					std::get<J>(sessions_).emplace(*client_, Command{index}, retry_policy_, adaptive_timeout_);
+				}
+				std::get<J>(sessions_)->start(callback<J>());
+				resend_separately_<I, J + 1>(end);
+			}
+		}
+	}
+
+	/// Recursively mark the fused write commands in [I, end) as succeeded, in partial mode.
+	template<std::size_t I, typename T>
+	void confirm_writes_(std::size_t end) {
+		if constexpr (I < Count) {
+			if constexpr (std::is_same<std::tuple_element_t<I, Commands>, WriteVar<T>>::value) {
+				if (I >= end) return;
+				std::get<I>(result_).emplace(estd::in_place_valid);
+				confirm_writes_<I + 1, T>(end);
+			}
+		}
+	}
+
+	/// Move the results out of their storage, in partial mode.
+	template<std::size_t... I>
+	response_type take_results_(std::index_sequence<I...>) {
+		return response_type{std::move(*std::get<I>(result_))...};
+	}
+
 	/// Recursively initialize sub-sessions.
 	template<std::size_t I>
-	void init_sessions_(Client & client, Commands && commands) {
+	void init_sessions_(Client & client, Commands && commands, RetryPolicy const & retry_policy, bool adaptive_timeout) {
 		if constexpr(I < Count) {
-			std::get<I>(sessions_).emplace(client, std::move(std::get<I>(commands)));
-			init_sessions_<I + 1>(client, std::move(commands));
+			if (fused_length_[I] == 1) {
+				std::get<I>(sessions_).emplace(client, std::move(std::get<I>(commands)), retry_policy, adaptive_timeout);
+			}
+			if constexpr (fusable<Commands, I>()) {
+				if (fused_length_[I] > 1) std::get<I>(fused_sessions_).emplace(client, fuse_<I>(commands), retry_policy, adaptive_timeout);
+			}
+			init_sessions_<I + 1>(client, std::move(commands), retry_policy, adaptive_timeout);
 		}
 	}
 
@@ -131,48 +377,75 @@ protected:
 	template<std::size_t I>
 	void start_sessions_() {
 		if constexpr(I < Count) {
-			std::get<I>(sessions_)->start(callback<I>());
+			if (std::get<I>(sessions_)) std::get<I>(sessions_)->start(callback<I>());
+			if constexpr (fusable<Commands, I>()) {
+				if (std::get<I>(fused_sessions_)) std::get<I>(fused_sessions_)->start(fusedCallback<I>());
+			}
 			start_sessions_<I + 1>();
 		}
 	}
 
-	/// Recursively start sub-sessions.
+	/// Recursively report unanswered sub-sessions as lost.
+	template<std::size_t I>
+	void report_loss_() {
+		if constexpr(I < Count) {
+			if (std::get<I>(sessions_)) std::get<I>(sessions_)->reportLoss();
+			if constexpr (fusable<Commands, I>()) {
+				if (std::get<I>(fused_sessions_)) std::get<I>(fused_sessions_)->reportLoss();
+			}
+			report_loss_<I + 1>();
+		}
+	}
+
+	/// Recursively stop sub-sessions.
 	template<std::size_t I>
 	void stop_sessions_(Error const & error) {
 		if constexpr(I < Count) {
-			std::get<I>(sessions_)->resolve(error);
+			if (std::get<I>(sessions_)) std::get<I>(sessions_)->resolve(error);
+			if constexpr (fusable<Commands, I>()) {
+				if (std::get<I>(fused_sessions_)) std::get<I>(fused_sessions_)->resolve(error);
+			}
 			stop_sessions_<I + 1>(error);
 		}
 	}
 };
 
-template<typename Commands>
+template<bool Partial = false, typename Commands, typename Callback>
 auto sendMultipleCommands(
 	Client & client,
 	Commands && commands,
 	std::chrono::steady_clock::time_point deadline,
-	std::function<void(typename MultiCommandSession<Commands>::result_type)> callback
+	RetryPolicy retry_policy,
+	bool adaptive_timeout,
+	Callback callback,
+	CancellationSignal * signal = nullptr
 ) {
-	using Session = DeadlineSession<MultiCommandSession<Commands>>;
-	auto session = std::make_shared<Session>(client.ios(), client, std::move(commands));
-	session->start(deadline, [&client, session, callback = std::move(callback)] (typename Session::result_type && result) mutable {
-		session->cancelTimeout();
-		std::move(callback)(std::move(result));
-
-		// Move the shared_ptr into a posted handler which resets it.
-		// That way, any queued event handlers can still completer succesfully.
-		client.ios().post([session = std::move(session)] () mutable {
+	// Unwrap handlers bound to a cancellation signal.
+	if constexpr (is_cancellable_handler<Callback>::value) {
+		return sendMultipleCommands<Partial>(client, std::forward<Commands>(commands), deadline, retry_policy, adaptive_timeout, std::move(callback.handler), callback.signal);
+	} else {
+		using Session = DeadlineSession<MultiCommandSession<std::decay_t<Commands>, Partial>>;
+		auto session = std::allocate_shared<Session>(handlerAllocator<Session>(callback), client, std::move(commands), retry_policy, adaptive_timeout);
+		session->start(deadline, [&client, session, callback = CompletionHandler<Callback>{std::move(callback)}] (typename Session::result_type && result) mutable {
+			session->cancelTimeout();
+			callback(std::move(result));
+
+			// Move the shared_ptr into a posted handler which resets it.
+			// That way, any queued event handlers can still completer succesfully.
+			client.ios().post(recycling([session = std::move(session)] () mutable {
+				session.reset();
+			}));
+
+			// Reset our own shared_ptr.
+			// Not really needed since we've moved out of it,
+			// but if the lambda is made non-mutable std::move silently doesn't move,
+			// and then we have a memory leak.
+			// This will make the compiler bark in that case.
 			session.reset();
 		});
-
-		// Reset our own shared_ptr.
-		// Not really needed since we've moved out of it,
-		// but if the lambda is made non-mutable std::move silently doesn't move,
-		// and then we have a memory leak.
-		// This will make the compiler bark in that case.
-		session.reset();
-	});
-	return session;
+		if (signal) signal->connect(session);
+		return session;
+	}
 }
 
 }}}}
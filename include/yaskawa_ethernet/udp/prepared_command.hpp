@@ -0,0 +1,111 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "../error.hpp"
+#include "command_traits.hpp"
+#include "message.hpp"
+#include "protocol.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+/// A command that is encoded once and can be sent many times.
+/**
+ * Sending a prepared command copies the encoded datagram and patches the request ID,
+ * instead of encoding the command again.
+ * This is useful for commands that are sent repeatedly, such as polling a status or a range of variables.
+ *
+ * Copies of a prepared command share the encoded datagram, so passing one to Client::sendCommand() does not allocate.
+ * A prepared command can be sent again while a previous send is still in flight.
+ */
+template<typename Command>
+class PreparedCommand {
+public:
+	using Response = typename Command::Response;
+
+private:
+	struct Data {
+		Command command;
+		std::vector<std::uint8_t> encoded;
+	};
+
+	std::shared_ptr<Data const> data_;
+
+public:
+	/// Encode a command.
+	explicit PreparedCommand(Command command) {
+		auto data = std::make_shared<Data>(Data{std::move(command), {}});
+		encode(data->encoded, 0, data->command);
+		data_ = std::move(data);
+	}
+
+	/// Get the prepared command.
+	Command const & command() const { return data_->command; }
+
+	/// Get the encoded datagram, with request ID 0.
+	std::vector<std::uint8_t> const & encoded() const { return data_->encoded; }
+};
+
+/// Create a prepared command.
+template<typename Command>
+PreparedCommand<Command> prepare(Command command) {
+	return PreparedCommand<Command>{std::move(command)};
+}
+
+/// Encode a prepared command by copying the encoded datagram and patching the request ID.
+template<typename Command>
+void encode(std::vector<std::uint8_t> & output, std::uint8_t request_id, PreparedCommand<Command> const & command) {
+	std::vector<std::uint8_t> const & encoded = command.encoded();
+	std::size_t start = output.size();
+	output.insert(output.end(), encoded.begin(), encoded.end());
+	output[start + header_offset::request_id] = request_id;
+}
+
+/// Validate a prepared command by validating the wrapped command.
+template<typename Command>
+Error validate(PreparedCommand<Command> const & command) {
+	return validate(command.command());
+}
+
+/// Decode the response to a prepared command.
+template<typename Command>
+Result<typename Command::Response> decode(ResponseHeader const & header, std::string_view & data, PreparedCommand<Command> const & command) {
+	return decode(header, data, command.command());
+}
+
+template<typename Command> struct is_idempotent<PreparedCommand<Command>> : is_idempotent<Command> {};
+
+}}}
@@ -52,12 +52,26 @@ Result<TYPE::Response> decode(ResponseHeader const & header, std::string_view &
 void encode(std::vector<std::uint8_t> & output, std::uint8_t request_id, TYPE const & command); \
 Result<TYPE::Response> decode(ResponseHeader const & header, std::string && data, TYPE const & command)
 
-// Declare ReadVar<TYPE>, ReadVars<TYPE>, WriteVar<TYPE> and WriteVars<TYPE> commands.
+// Declare ReadVar<TYPE>, ReadVars<TYPE>, ReadVarsInto<TYPE>, WriteVar<TYPE> and WriteVars<TYPE> commands.
 #define DECLARE_VAR(TYPE) \
 DECLARE_COMMAND(ReadVar<TYPE>); \
 DECLARE_COMMAND(ReadVars<TYPE>); \
+DECLARE_COMMAND(ReadVarsInto<TYPE>); \
 DECLARE_COMMAND(WriteVar<TYPE>); \
-DECLARE_COMMAND(WriteVars<TYPE>)
+DECLARE_COMMAND(WriteVars<TYPE>); \
+Error validate(ReadVars<TYPE> const & command); \
+Error validate(ReadVarsInto<TYPE> const & command); \
+Error validate(WriteVars<TYPE> const & command)
+
+/// Check the parameters of a command before it is sent.
+/**
+ * Commands that can not be encoded correctly are rejected with an std::errc::invalid_argument error.
+ * Commands without parameters to check are always valid.
+ */
+template<typename Command>
+Error validate(Command const &) {
+	return {};
+}
 
 DECLARE_COMMAND(ReadStatus);
 DECLARE_COMMAND(ReadCurrentPosition);
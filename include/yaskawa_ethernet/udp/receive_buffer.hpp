@@ -0,0 +1,153 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "message.hpp"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+/// Maximum size of a message, including the header.
+constexpr std::size_t max_message_size = header_size + max_payload_size;
+
+namespace impl {
+	struct ReceiveBufferStore;
+
+	/// Pooled storage for a single message.
+	struct ReceiveBlock {
+		std::array<std::uint8_t, max_message_size> data;
+		std::size_t references = 0;
+		ReceiveBufferStore * store = nullptr;
+	};
+
+	/// Shared state of a pool, kept alive until the pool and all buffers are gone.
+	struct ReceiveBufferStore {
+		std::vector<std::unique_ptr<ReceiveBlock>> free;
+		std::size_t in_use = 0;
+		std::size_t max_free = 0;
+		bool detached = false;
+	};
+}
+
+/// Reference counted handle to a pooled receive buffer.
+/**
+ * Copying the handle shares the buffer.
+ * When the last handle is destroyed, the buffer is returned to the pool it came from.
+ *
+ * Like the Client, handles and pools are not thread-safe.
+ */
+class ReceiveBuffer {
+	friend class ReceiveBufferPool;
+
+	impl::ReceiveBlock * block_ = nullptr;
+
+	explicit ReceiveBuffer(impl::ReceiveBlock * block) : block_{block} {
+		++block_->references;
+	}
+
+public:
+	/// Construct an empty handle.
+	ReceiveBuffer() = default;
+
+	ReceiveBuffer(ReceiveBuffer const & other) : block_{other.block_} {
+		if (block_) ++block_->references;
+	}
+
+	ReceiveBuffer(ReceiveBuffer && other) noexcept : block_{std::exchange(other.block_, nullptr)} {}
+
+	ReceiveBuffer & operator=(ReceiveBuffer const & other) {
+		ReceiveBuffer copy{other};
+		std::swap(block_, copy.block_);
+		return *this;
+	}
+
+	ReceiveBuffer & operator=(ReceiveBuffer && other) noexcept {
+		ReceiveBuffer moved{std::move(other)};
+		std::swap(block_, moved.block_);
+		return *this;
+	}
+
+	~ReceiveBuffer() { reset(); }
+
+	/// Release the buffer.
+	void reset();
+
+	/// Check if the handle refers to a buffer.
+	explicit operator bool() const { return block_ != nullptr; }
+
+	/// Check if other handles share the buffer.
+	bool shared() const { return block_ && block_->references > 1; }
+
+	/// Get a pointer to the data of the buffer.
+	std::uint8_t       * data()       { return block_->data.data(); }
+	std::uint8_t const * data() const { return block_->data.data(); }
+
+	/// Get the size of the buffer.
+	static constexpr std::size_t size() { return max_message_size; }
+
+	/// Get a view of the first \p length bytes of the buffer.
+	std::string_view view(std::size_t length) const {
+		return {reinterpret_cast<char const *>(data()), length};
+	}
+};
+
+/// Pool of receive buffers.
+/**
+ * Released buffers are kept for reuse, up to a limit.
+ * Buffers that are still in use when the pool is destroyed are freed when they are released.
+ */
+class ReceiveBufferPool {
+	impl::ReceiveBufferStore * store_;
+
+public:
+	explicit ReceiveBufferPool(std::size_t max_free = 64);
+
+	ReceiveBufferPool(ReceiveBufferPool const &) = delete;
+	ReceiveBufferPool & operator=(ReceiveBufferPool const &) = delete;
+
+	~ReceiveBufferPool();
+
+	/// Get a buffer from the pool, allocating a new one if no free buffer is available.
+	ReceiveBuffer acquire();
+
+	/// Get the number of buffers currently in use.
+	std::size_t inUse() const { return store_->in_use; }
+
+	/// Get the number of free buffers kept for reuse.
+	std::size_t available() const { return store_->free.size(); }
+};
+
+}}}
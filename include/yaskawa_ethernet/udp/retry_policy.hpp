@@ -0,0 +1,61 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include <chrono>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+/// Policy for resending a command that did not get a reply.
+/**
+ * The command is resent unchanged (with the same request ID) if no reply arrives within attempt_timeout.
+ * The deadline of the command still applies to the command as a whole.
+ *
+ * By default, only idempotent commands (see is_idempotent) are resent.
+ *
+ * The protocol only has an 8 bit request ID to match replies with requests,
+ * so a reply to an earlier copy that arrives after the command finished can not always be recognized.
+ * While the request ID is free, such a reply is reported as an unknown request.
+ * Request IDs are reused in the order they were released, which makes it unlikely that the ID has been handed out again,
+ * but a reply that is delayed long enough for all other request IDs to be used
+ * is delivered to whichever command holds the request ID at that time.
+ */
+struct RetryPolicy {
+	/// Time to wait for a reply before resending the command.
+	std::chrono::steady_clock::duration attempt_timeout = std::chrono::steady_clock::duration::zero();
+
+	/// Maximum number of times to resend the command (0 disables retransmission).
+	int max_retries = 0;
+
+	/// If true, also resend commands that are not idempotent.
+	bool retry_non_idempotent = false;
+};
+
+}}}
@@ -0,0 +1,294 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "udp/message.hpp"
+
+#include <asio/io_service.hpp>
+#include <asio/ip/udp.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+/// Minimal controller for tests that answers variable commands on the loopback interface.
+/**
+ * The controller runs in its own thread and handles one request at a time.
+ * Variables that were never written read as zero.
+ */
+class FakeController {
+public:
+	/// Request received by the controller.
+	struct Request {
+		std::uint16_t command;
+		std::uint16_t instance;
+		std::uint8_t service;
+
+		/// Number of variables read or written.
+		std::uint32_t count;
+	};
+
+private:
+	asio::io_service ios_;
+	asio::ip::udp::socket socket_{ios_, asio::ip::udp::endpoint{asio::ip::address_v4::loopback(), 0}};
+	std::atomic_bool stop_{false};
+
+	mutable std::mutex mutex_;
+
+	/// Encoded variables, by single variable command and index.
+	std::map<std::pair<std::uint16_t, int>, std::vector<std::uint8_t>> variables_;
+
+	std::vector<Request> requests_;
+	std::chrono::steady_clock::duration delay_ = std::chrono::steady_clock::duration::zero();
+	int drop_next_ = 0;
+	bool silent_   = false;
+	std::set<std::uint16_t> ignored_;
+	std::set<std::uint16_t> failing_;
+
+	std::thread thread_;
+
+public:
+	FakeController() {
+		thread_ = std::thread([this] () { run(); });
+	}
+
+	~FakeController() {
+		// Wake up the blocking receive with an empty message.
+		stop_ = true;
+		asio::io_service ios;
+		asio::ip::udp::socket waker{ios, asio::ip::udp::v4()};
+		waker.send_to(asio::buffer(&stop_, 0), socket_.local_endpoint());
+		thread_.join();
+	}
+
+	std::uint16_t port() const {
+		return socket_.local_endpoint().port();
+	}
+
+	/// Wait before sending each reply.
+	void setDelay(std::chrono::steady_clock::duration delay) {
+		std::lock_guard<std::mutex> lock{mutex_};
+		delay_ = delay;
+	}
+
+	/// Do not reply to the next requests.
+	void dropNext(int count) {
+		std::lock_guard<std::mutex> lock{mutex_};
+		drop_next_ = count;
+	}
+
+	/// Do not reply to any request.
+	void setSilent(bool silent) {
+		std::lock_guard<std::mutex> lock{mutex_};
+		silent_ = silent;
+	}
+
+	/// Do not reply to requests for variables starting at an index.
+	void ignore(std::uint16_t instance) {
+		std::lock_guard<std::mutex> lock{mutex_};
+		ignored_.insert(instance);
+	}
+
+	/// Reply with an error status to requests for variables starting at an index.
+	void fail(std::uint16_t instance) {
+		std::lock_guard<std::mutex> lock{mutex_};
+		failing_.insert(instance);
+	}
+
+	/// Get all requests received so far.
+	std::vector<Request> requests() const {
+		std::lock_guard<std::mutex> lock{mutex_};
+		return requests_;
+	}
+
+	/// Forget the requests received so far.
+	void clearRequests() {
+		std::lock_guard<std::mutex> lock{mutex_};
+		requests_.clear();
+	}
+
+	std::int32_t int32(std::uint16_t index) const {
+		std::lock_guard<std::mutex> lock{mutex_};
+		auto variable = variables_.find({commands::robot::readwrite_int32_variable, index});
+		if (variable == variables_.end()) return 0;
+		return read(variable->second.data(), 4);
+	}
+
+	void setInt32(std::uint16_t index, std::int32_t value) {
+		std::lock_guard<std::mutex> lock{mutex_};
+		std::vector<std::uint8_t> & variable = variables_[{commands::robot::readwrite_int32_variable, index}];
+		variable.clear();
+		write(variable, value, 4);
+	}
+
+	std::uint8_t uint8(std::uint16_t index) const {
+		std::lock_guard<std::mutex> lock{mutex_};
+		auto variable = variables_.find({commands::robot::readwrite_int8_variable, index});
+		if (variable == variables_.end()) return 0;
+		return variable->second[0];
+	}
+
+	void setUint8(std::uint16_t index, std::uint8_t value) {
+		std::lock_guard<std::mutex> lock{mutex_};
+		variables_[{commands::robot::readwrite_int8_variable, index}] = {value};
+	}
+
+private:
+	static std::uint32_t read(std::uint8_t const * data, int size) {
+		std::uint32_t result = 0;
+		for (int i = 0; i < size; ++i) result |= std::uint32_t(data[i]) << 8 * i;
+		return result;
+	}
+
+	static void write(std::vector<std::uint8_t> & out, std::uint32_t value, int size) {
+		for (int i = 0; i < size; ++i) out.push_back(value >> 8 * i);
+	}
+
+	/// Get the single variable command for a single or multiple variable command.
+	static std::uint16_t singleCommand(std::uint16_t command) {
+		using namespace commands::robot;
+		switch (command) {
+			case readwrite_multiple_int8:           return readwrite_int8_variable;
+			case readwrite_multiple_int16:          return readwrite_int16_variable;
+			case readwrite_multiple_int32:          return readwrite_int32_variable;
+			case readwrite_multiple_float:          return readwrite_float_variable;
+			case readwrite_multiple_robot_position: return readwrite_robot_position_variable;
+		}
+		return command;
+	}
+
+	/// Get the encoded size of a variable, or 0 for unsupported commands.
+	static std::size_t variableSize(std::uint16_t command) {
+		using namespace commands::robot;
+		switch (singleCommand(command)) {
+			case readwrite_int8_variable:           return 1;
+			case readwrite_int16_variable:          return 2;
+			case readwrite_int32_variable:          return 4;
+			case readwrite_float_variable:          return 4;
+			case readwrite_robot_position_variable: return 13 * 4;
+		}
+		return 0;
+	}
+
+	/// Get the encoded value of a variable.
+	std::vector<std::uint8_t> & variable(std::uint16_t command, int index) {
+		std::vector<std::uint8_t> & result = variables_[{singleCommand(command), index}];
+		result.resize(variableSize(command));
+		return result;
+	}
+
+	/// Handle a request and build the reply data.
+	/**
+	 * \return the status for the reply, or -1 if the request should not be answered.
+	 */
+	int handle(std::uint8_t const * request, std::size_t size, std::vector<std::uint8_t> & data) {
+		std::uint16_t command  = read(&request[header_offset::command], 2);
+		std::uint16_t instance = read(&request[header_offset::instance], 2);
+		std::uint8_t  service  = request[header_offset::service];
+		std::uint8_t const * payload = request + header_size;
+		bool multiple = service == service::read_multiple || service == service::write_multiple;
+		std::uint32_t count = multiple && size >= header_size + 4 ? read(payload, 4) : 1;
+
+		std::lock_guard<std::mutex> lock{mutex_};
+		requests_.push_back({command, instance, service, count});
+
+		if (silent_ || ignored_.count(instance)) return -1;
+		if (drop_next_ > 0) {
+			--drop_next_;
+			return -1;
+		}
+		if (failing_.count(instance)) return 0x1f;
+
+		// The controller only accepts an even number of B variables.
+		std::size_t element_size = variableSize(command);
+		if (element_size == 0) return 0x08;
+		if (command == commands::robot::readwrite_multiple_int8 && count % 2 != 0) return 0x1f;
+		if (multiple) payload += 4;
+
+		if (service == service::get_all || service == service::read_multiple) {
+			if (multiple) write(data, count, 4);
+			for (std::uint32_t i = 0; i < count; ++i) {
+				std::vector<std::uint8_t> const & value = variable(command, instance + i);
+				data.insert(data.end(), value.begin(), value.end());
+			}
+		} else if (service == service::set_all || service == service::write_multiple) {
+			if (size < std::size_t(payload - request) + count * element_size) return 0x1f;
+			for (std::uint32_t i = 0; i < count; ++i) {
+				std::vector<std::uint8_t> & value = variable(command, instance + i);
+				value.assign(payload + i * element_size, payload + (i + 1) * element_size);
+			}
+		}
+		return 0;
+	}
+
+	void run() {
+		std::array<std::uint8_t, 2048> request;
+		asio::ip::udp::endpoint sender;
+		while (true) {
+			std::size_t size = socket_.receive_from(asio::buffer(request), sender);
+			if (stop_) return;
+			if (size < header_size) continue;
+
+			std::vector<std::uint8_t> data;
+			int status = handle(request.data(), size, data);
+			if (status < 0) continue;
+
+			std::chrono::steady_clock::duration delay;
+			{
+				std::lock_guard<std::mutex> lock{mutex_};
+				delay = delay_;
+			}
+			if (delay > std::chrono::steady_clock::duration::zero()) std::this_thread::sleep_for(delay);
+
+			std::vector<std::uint8_t> response = {'Y', 'E', 'R', 'C'};
+			write(response, header_size, 2);
+			write(response, data.size(), 2);
+			response.insert(response.end(), {3, request[header_offset::division], 1, request[header_offset::request_id]});
+			write(response, 0x80000000, 4);
+			response.insert(response.end(), 8, '9');
+			response.insert(response.end(), {std::uint8_t(request[header_offset::service] + 0x80), std::uint8_t(status), std::uint8_t(status ? 1 : 0), 0});
+			write(response, status ? 0x2010 : 0, 2);
+			write(response, 0, 2);
+			response.insert(response.end(), data.begin(), data.end());
+			socket_.send_to(asio::buffer(response), sender);
+		}
+	}
+};
+
+}}}
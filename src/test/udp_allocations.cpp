@@ -0,0 +1,128 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "commands.hpp"
+#include "udp/client.hpp"
+#include "fake_controller.hpp"
+
+#include <asio/io_service.hpp>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <new>
+
+namespace {
+	/// Number of heap allocations made by the current thread while counting is enabled.
+	thread_local bool counting_allocations = false;
+	thread_local std::size_t allocations   = 0;
+
+	void * allocate(std::size_t size) {
+		if (counting_allocations) ++allocations;
+		if (void * pointer = std::malloc(size ? size : 1)) return pointer;
+		throw std::bad_alloc{};
+	}
+
+	// Not inlined, so the compiler does not see free() called on pointers from operator new.
+	[[gnu::noinline]] void deallocate(void * pointer) noexcept {
+		std::free(pointer);
+	}
+}
+
+// Replace all forms of the global new and delete operators, so every allocation is counted
+// and every deallocation is paired with the matching allocation function.
+void * operator new  (std::size_t size) { return allocate(size); }
+void * operator new[](std::size_t size) { return allocate(size); }
+void operator delete  (void * pointer) noexcept { deallocate(pointer); }
+void operator delete[](void * pointer) noexcept { deallocate(pointer); }
+void operator delete  (void * pointer, std::size_t) noexcept { deallocate(pointer); }
+void operator delete[](void * pointer, std::size_t) noexcept { deallocate(pointer); }
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+TEST(UdpClient, steadyStateCommandsDoNotAllocate) {
+	using namespace std::chrono_literals;
+	constexpr int warmup   = 200;
+	constexpr int measured = 1000;
+
+	FakeController controller;
+	asio::io_service ios;
+	Client client{ios};
+
+	int sent = 0;
+	int failed = 0;
+	std::size_t allocations_after_warmup = 0;
+
+	// Alternate WriteVar and ReadVar commands, sending the next one from the callback of the previous one.
+	std::function<void()> next = [&] () {
+		if (sent == warmup) {
+			allocations = 0;
+			counting_allocations = true;
+		}
+		if (sent == warmup + measured) {
+			counting_allocations = false;
+			allocations_after_warmup = allocations;
+			client.close();
+			return;
+		}
+		std::int32_t value = sent++;
+		if (value % 2 == 0) {
+			client.sendCommand(WriteInt32Var{7, value}, 1s, [&] (Result<void> result) {
+				if (!result) ++failed;
+				next();
+			});
+		} else {
+			client.sendCommand(ReadInt32Var{7}, 1s, [&, value] (Result<std::int32_t> result) {
+				if (!result || *result != value - 1) ++failed;
+				next();
+			});
+		}
+	};
+
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		next();
+	});
+	ios.run();
+	counting_allocations = false;
+
+	ASSERT_EQ(sent, warmup + measured);
+	ASSERT_EQ(failed, 0);
+	ASSERT_EQ(allocations_after_warmup, 0u);
+}
+
+}}}
@@ -0,0 +1,118 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "commands.hpp"
+#include "udp/client.hpp"
+#include "udp/protocol.hpp"
+#include "fake_controller.hpp"
+
+#include <asio/io_service.hpp>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+using namespace std::chrono_literals;
+
+#ifdef __linux__
+TEST(UdpClientBatchReceive, burstOfRepliesIsDispatched) {
+	FakeController controller;
+	asio::io_service ios;
+	Client client{ios};
+	client.setBatchReceive(true);
+	ASSERT_TRUE(client.batchReceive());
+
+	/// Reply kept by a handler, with a copy of the data when it was received.
+	struct KeptReply {
+		ReceiveBuffer buffer;
+		std::string_view data;
+		std::string copy;
+	};
+
+	// More than three times the number of messages read with a single recvmmsg() call.
+	constexpr std::uint16_t count = 100;
+	std::vector<std::vector<std::uint8_t>> requests(count);
+	std::vector<KeptReply> kept;
+	std::set<std::uint8_t> replied;
+
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		for (std::uint16_t i = 0; i < count; ++i) {
+			controller.setInt32(i, 1000 + i);
+			std::uint8_t request_id = *client.allocateId();
+			auto token = std::make_shared<Client::HandlerToken>();
+			*token = client.registerHandler(request_id, [&, request_id, token] (ResponseHeader const & header, std::string_view data, ReceiveBuffer const & buffer) {
+				EXPECT_EQ(header.request_id, request_id);
+
+				// Block the IO thread on the first reply until the controller answered all requests,
+				// so the other replies pile up in the socket and are read in a burst.
+				if (replied.empty()) {
+					auto give_up = std::chrono::steady_clock::now() + 10s;
+					while (controller.requests().size() < count && std::chrono::steady_clock::now() < give_up) std::this_thread::yield();
+					EXPECT_EQ(controller.requests().size(), count);
+				}
+				replied.insert(header.request_id);
+
+				// Every other handler keeps the buffer.
+				if (header.request_id % 2 == 0) kept.push_back({buffer, data, std::string{data}});
+				client.removeHandler(*token);
+				if (replied.size() == count) client.close();
+			});
+			encode(requests[i], request_id, ReadInt32Var{i});
+			client.send(asio::buffer(requests[i]), [] (std::error_code error) { ADD_FAILURE() << error.message(); });
+		}
+	});
+	ios.run();
+
+	EXPECT_EQ(replied.size(), count);
+	EXPECT_EQ(kept.size(), count / 2);
+
+	// Kept buffers were replaced instead of being overwritten by later replies.
+	std::set<std::uint8_t const *> buffers;
+	for (KeptReply const & reply : kept) {
+		EXPECT_EQ(reply.data, reply.copy);
+		buffers.insert(reply.buffer.data());
+	}
+	EXPECT_EQ(buffers.size(), kept.size());
+}
+#endif
+
+}}}
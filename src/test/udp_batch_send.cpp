@@ -0,0 +1,171 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "commands.hpp"
+#include "udp/client.hpp"
+#include "udp/protocol.hpp"
+#include "fake_controller.hpp"
+
+#include <asio/io_service.hpp>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+using namespace std::chrono_literals;
+
+TEST(UdpClientBatchSend, cancelledMessagesAreNotSent) {
+	FakeController controller;
+	asio::io_service ios;
+	Client client{ios};
+	client.setBatchSend(true);
+
+	std::vector<std::uint8_t> first;
+	std::vector<std::uint8_t> second;
+
+	int errors = 0;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		encode(first,  *client.allocateId(), ReadInt32Var{1});
+		std::uint8_t second_id = *client.allocateId();
+		encode(second, second_id, ReadInt32Var{2});
+
+		// The messages are sent in order, so the first would reach the controller before the reply to the second arrives.
+		client.registerHandler(second_id, [&] (ResponseHeader const &, std::string_view, ReceiveBuffer const &) { client.close(); });
+
+		Client::SendToken token = client.send(asio::buffer(first), [&] (std::error_code) { ++errors; });
+		EXPECT_NE(token, 0u);
+		EXPECT_NE(client.send(asio::buffer(second), [&] (std::error_code) { ++errors; }), 0u);
+
+		// The queue is only flushed after this handler returns.
+		client.cancelSend(token);
+		first.clear();
+		first.shrink_to_fit();
+	});
+	ios.run();
+
+	std::vector<FakeController::Request> requests = controller.requests();
+	ASSERT_EQ(requests.size(), 1u);
+	EXPECT_EQ(requests[0].instance, 2);
+	EXPECT_EQ(errors, 0);
+}
+
+TEST(UdpClientBatchSend, finishedCommandsAreRemovedFromTheQueue) {
+	FakeController controller;
+	asio::io_service ios;
+	Client client{ios};
+	client.setBatchSend(true);
+
+	CancellationSignal signal;
+	int aborted = 0;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		for (std::uint16_t i = 0; i < 3; ++i) {
+			client.sendCommand(ReadInt32Var{i}, 1s, bindCancellation(signal, [&] (Result<std::int32_t> result) {
+				ASSERT_FALSE(result);
+				EXPECT_EQ(result.error().code(), asio::error::operation_aborted);
+				++aborted;
+			}));
+		}
+
+		// Cancel the commands while their messages are still queued, so their buffers are released before the flush.
+		signal.cancel();
+		client.sendCommand(ReadInt32Var{7}, 1s, [&] (Result<std::int32_t> result) {
+			ASSERT_TRUE(result) << result.error().format();
+			client.close();
+		});
+	});
+	ios.run();
+
+	EXPECT_EQ(aborted, 3);
+	std::vector<FakeController::Request> requests = controller.requests();
+	ASSERT_EQ(requests.size(), 1u);
+	EXPECT_EQ(requests[0].instance, 7);
+}
+
+TEST(UdpClientBatchSend, destroyingTheClientAbortsTheQueuedMessages) {
+	FakeController controller;
+	asio::io_service ios;
+	auto client = std::make_unique<Client>(ios);
+	client->setBatchSend(true);
+
+	std::vector<std::uint8_t> message;
+	encode(message, 1, ReadInt32Var{1});
+
+	int errors = 0;
+	client->connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		ios.post([&] () {
+			for (int i = 0; i < 3; ++i) client->send(asio::buffer(message), [&] (std::error_code) { ++errors; });
+
+			// The flush is still pending, so it must not touch the destroyed client.
+			client = nullptr;
+		});
+	});
+	ios.run();
+
+	EXPECT_EQ(errors, 0);
+	EXPECT_EQ(controller.requests().size(), 0u);
+}
+
+TEST(UdpClientBatchSend, closingTheClientReportsTheQueuedMessages) {
+	FakeController controller;
+	asio::io_service ios;
+	Client client{ios};
+	client.setBatchSend(true);
+
+	std::vector<std::uint8_t> message;
+	encode(message, 1, ReadInt32Var{1});
+
+	std::vector<std::error_code> errors;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		for (int i = 0; i < 3; ++i) client.send(asio::buffer(message), [&] (std::error_code error) { errors.push_back(error); });
+		client.close();
+	});
+	ios.run();
+
+	ASSERT_EQ(errors.size(), 3u);
+	for (std::error_code const & error : errors) EXPECT_EQ(error, asio::error::bad_descriptor);
+	EXPECT_EQ(controller.requests().size(), 0u);
+}
+
+}}}
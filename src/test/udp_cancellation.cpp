@@ -0,0 +1,99 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "commands.hpp"
+#include "udp/cancellation.hpp"
+#include "udp/client.hpp"
+#include "fake_controller.hpp"
+
+#include <asio/io_service.hpp>
+#include <gtest/gtest.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+using namespace std::chrono_literals;
+
+TEST(UdpClientCancellation, cancelReleasesResources) {
+	FakeController controller;
+	controller.setSilent(true);
+
+	asio::io_service ios;
+	Client client{ios};
+	client.setMaxInFlight(2);
+
+	CancellationSignal signal;
+	std::array<int, 4> calls{};
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+
+		// Two commands get a request ID, the other two wait in the submission queue.
+		for (std::size_t i = 0; i < calls.size(); ++i) {
+			client.sendCommand(ReadInt32Var{std::uint16_t(i)}, 10s, bindCancellation(signal, [&, i] (Result<std::int32_t> result) {
+				++calls[i];
+				ASSERT_FALSE(result);
+				EXPECT_EQ(result.error().code(), asio::error::operation_aborted);
+			}));
+		}
+
+		// Let the first two requests be sent before cancelling.
+		client.scheduleDeadline(std::chrono::steady_clock::now() + 20ms, [&] () {
+			EXPECT_EQ(client.inFlight(), 2u);
+			EXPECT_EQ(client.queueSize(), 2u);
+
+			// All handlers run before cancel() returns.
+			signal.cancel();
+			EXPECT_EQ(calls, (std::array<int, 4>{1, 1, 1, 1}));
+			EXPECT_EQ(client.inFlight(), 0u);
+			EXPECT_EQ(client.queueSize(), 0u);
+			EXPECT_EQ(client.pendingDeadlines(), 0u);
+
+			// Cancelling again does not invoke the handlers again.
+			signal.cancel();
+			client.scheduleDeadline(std::chrono::steady_clock::now() + 20ms, [&] () { client.close(); });
+		});
+	});
+	ios.run();
+
+	EXPECT_EQ(calls, (std::array<int, 4>{1, 1, 1, 1}));
+
+	// The queued commands were never sent.
+	for (FakeController::Request const & request : controller.requests()) EXPECT_LT(request.instance, 2);
+}
+
+}}}
@@ -0,0 +1,174 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "commands.hpp"
+#include "udp/client.hpp"
+#include "udp/protocol.hpp"
+#include "fake_controller.hpp"
+
+#include <asio/io_service.hpp>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+using namespace std::chrono_literals;
+
+TEST(UdpClientChunkedCommand, failingChunkCancelsOtherChunks) {
+	FakeController controller;
+	asio::io_service ios;
+	Client client{ios};
+
+	// 300 int32 variables are sent as chunks starting at 0, 118 and 236.
+	// The middle chunk fails, the others would only end at the deadline.
+	controller.ignore(0);
+	controller.fail(118);
+	controller.ignore(236);
+
+	auto output = std::make_unique<std::vector<std::int32_t>>(300);
+	int calls = 0;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		client.sendCommand(ReadInt32VarsInto{0, 300, output->data()}, 10s, [&] (Result<void> result) {
+			++calls;
+			ASSERT_FALSE(result);
+			EXPECT_EQ(result.error().code(), make_error_code(errc::command_failed));
+
+			// No chunk may still write into the output.
+			EXPECT_EQ(client.inFlight(), 0u);
+			EXPECT_EQ(client.queueSize(), 0u);
+			EXPECT_EQ(client.pendingDeadlines(), 0u);
+			output.reset();
+			client.close();
+		});
+	});
+	ios.run();
+
+	EXPECT_EQ(calls, 1);
+	EXPECT_EQ(controller.requests().size(), 3u);
+}
+
+TEST(UdpClientChunkedCommand, singleByteVariablesAreAccepted) {
+	EXPECT_FALSE(validate(ReadUint8Vars{5, 1}));
+	EXPECT_FALSE(validate(WriteUint8Vars{6, {9}}));
+	EXPECT_TRUE(validate(ReadUint8Vars{5, 3}));
+
+	FakeController controller;
+	controller.setUint8(5, 42);
+
+	asio::io_service ios;
+	Client client{ios};
+
+	int calls = 0;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		client.sendCommand(ReadUint8Vars{5, 1}, 1s, [&] (Result<std::vector<std::uint8_t>> result) {
+			++calls;
+			ASSERT_TRUE(result) << result.error().format();
+			EXPECT_EQ(*result, std::vector<std::uint8_t>{42});
+			client.sendCommand(WriteUint8Vars{6, {9}}, 1s, [&] (Result<void> result) {
+				++calls;
+				ASSERT_TRUE(result) << result.error().format();
+				client.close();
+			});
+		});
+	});
+	ios.run();
+
+	EXPECT_EQ(calls, 2);
+	EXPECT_EQ(controller.uint8(6), 9);
+
+	// Both are sent as single variable requests.
+	std::vector<FakeController::Request> requests = controller.requests();
+	ASSERT_EQ(requests.size(), 2u);
+	for (FakeController::Request const & request : requests) {
+		EXPECT_EQ(request.command, commands::robot::readwrite_int8_variable);
+		EXPECT_EQ(request.count, 1u);
+	}
+}
+
+TEST(UdpClientChunkedCommand, oddByteRangesEndInASingleVariable) {
+	FakeController controller;
+	for (int i = 0; i < 475; ++i) controller.setUint8(i, i % 251);
+
+	asio::io_service ios;
+	Client client{ios};
+
+	std::vector<std::uint8_t> written(477);
+	for (std::size_t i = 0; i < written.size(); ++i) written[i] = i % 7;
+
+	int calls = 0;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+
+		// Sent as chunks of 474 and 1 variables.
+		client.sendCommand(ReadUint8Vars{0, 475}, 1s, [&] (Result<std::vector<std::uint8_t>> result) {
+			++calls;
+			ASSERT_TRUE(result) << result.error().format();
+			ASSERT_EQ(result->size(), 475u);
+			for (int i = 0; i < 475; ++i) EXPECT_EQ((*result)[i], i % 251) << "variable " << i;
+			controller.clearRequests();
+
+			// Sent as chunks of 474, 2 and 1 variables.
+			client.sendCommand(WriteUint8Vars{1000, written}, 1s, [&] (Result<void> result) {
+				++calls;
+				ASSERT_TRUE(result) << result.error().format();
+				client.close();
+			});
+		});
+	});
+	ios.run();
+
+	EXPECT_EQ(calls, 2);
+	for (std::size_t i = 0; i < written.size(); ++i) EXPECT_EQ(controller.uint8(1000 + i), written[i]) << "variable " << 1000 + i;
+
+	std::vector<FakeController::Request> requests = controller.requests();
+	ASSERT_EQ(requests.size(), 3u);
+	std::sort(requests.begin(), requests.end(), [] (auto const & a, auto const & b) { return a.instance < b.instance; });
+	EXPECT_EQ(requests[0].instance, 1000);
+	EXPECT_EQ(requests[0].count, 474u);
+	EXPECT_EQ(requests[1].instance, 1474);
+	EXPECT_EQ(requests[1].count, 2u);
+	EXPECT_EQ(requests[2].instance, 1476);
+	EXPECT_EQ(requests[2].count, 1u);
+	EXPECT_EQ(requests[2].command, commands::robot::readwrite_int8_variable);
+}
+
+}}}
@@ -0,0 +1,107 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "commands.hpp"
+#include "udp/client.hpp"
+#include "fake_controller.hpp"
+
+#include <asio/io_service.hpp>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+using namespace std::chrono_literals;
+
+TEST(UdpClientCommandBatch, failingCommandCancelsTheRest) {
+	FakeController controller;
+	asio::io_service ios;
+	Client client{ios};
+
+	// The file request has instance 0, so it is ignored as well.
+	controller.fail(5);
+	controller.ignore(6);
+	controller.ignore(0);
+
+	int calls = 0;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		std::vector<AnyCommand> commands{ReadInt32Var{5}, ReadInt32Var{6}, ReadFile{"JOB.JBI"}};
+		client.sendBatch(std::move(commands), 10s, [&] (Result<std::vector<AnyResponse>> result) {
+			++calls;
+			ASSERT_FALSE(result);
+			EXPECT_EQ(result.error().code(), make_error_code(errc::command_failed));
+
+			// The other command and the file transfer must be stopped already.
+			EXPECT_EQ(client.inFlight(), 0u);
+			EXPECT_EQ(client.queueSize(), 0u);
+			EXPECT_EQ(client.pendingDeadlines(), 0u);
+			client.close();
+		});
+	});
+	ios.run();
+
+	EXPECT_EQ(calls, 1);
+}
+
+TEST(UdpClientCommandBatch, fileTransfersEndAtTheDeadline) {
+	FakeController controller;
+	asio::io_service ios;
+	Client client{ios};
+	controller.setSilent(true);
+
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::time_point end;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		start = std::chrono::steady_clock::now();
+		std::vector<AnyCommand> commands{ReadFile{"JOB.JBI"}};
+		client.sendBatch(std::move(commands), start + 50ms, [&] (Result<std::vector<AnyResponse>> result) {
+			end = std::chrono::steady_clock::now();
+			ASSERT_FALSE(result);
+			EXPECT_EQ(result.error().code(), std::errc::timed_out);
+			client.close();
+		});
+	});
+	ios.run();
+
+	EXPECT_GE(end - start, 50ms);
+	EXPECT_LT(end - start, 1s);
+}
+
+}}}
@@ -0,0 +1,240 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "commands.hpp"
+#include "recycling_allocator.hpp"
+#include "udp/client.hpp"
+#include "fake_controller.hpp"
+
+#include <asio/associated_allocator.hpp>
+#include <asio/bind_executor.hpp>
+#include <asio/io_service.hpp>
+#include <asio/strand.hpp>
+#include <asio/use_future.hpp>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <type_traits>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+using namespace std::chrono_literals;
+
+namespace {
+	/// Allocator that counts the allocations made with it.
+	template<typename T>
+	struct CountingAllocator {
+		using value_type = T;
+
+		std::size_t * allocations;
+
+		explicit CountingAllocator(std::size_t * allocations) : allocations{allocations} {}
+
+		template<typename U>
+		CountingAllocator(CountingAllocator<U> const & other) : allocations{other.allocations} {}
+
+		T * allocate(std::size_t n) {
+			++*allocations;
+			return std::allocator<T>{}.allocate(n);
+		}
+
+		void deallocate(T * pointer, std::size_t n) noexcept {
+			std::allocator<T>{}.deallocate(pointer, n);
+		}
+
+		template<typename U> bool operator==(CountingAllocator<U> const & other) const noexcept { return allocations == other.allocations; }
+		template<typename U> bool operator!=(CountingAllocator<U> const & other) const noexcept { return allocations != other.allocations; }
+	};
+
+	/// Handler with a CountingAllocator as associated allocator.
+	template<typename Callback>
+	struct CountingHandler {
+		using allocator_type = CountingAllocator<void>;
+
+		std::size_t * allocations;
+		Callback callback;
+
+		allocator_type get_allocator() const noexcept { return allocator_type{allocations}; }
+
+		template<typename... Args>
+		void operator() (Args && ... args) {
+			callback(std::forward<Args>(args)...);
+		}
+	};
+
+	template<typename Callback>
+	CountingHandler<Callback> countingHandler(std::size_t & allocations, Callback callback) {
+		return {&allocations, std::move(callback)};
+	}
+}
+
+TEST(UdpClientCompletionToken, useFuture) {
+	FakeController controller;
+	controller.setInt32(1, 10);
+
+	asio::io_service ios;
+	Client client{ios};
+	std::promise<std::future<Result<std::int32_t>>> started;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		started.set_value(client.sendCommand(ReadInt32Var{1}, 1s, asio::use_future));
+	});
+	std::thread thread{[&] () { ios.run(); }};
+
+	std::future<std::future<Result<std::int32_t>>> sent = started.get_future();
+	ASSERT_EQ(sent.wait_for(2s), std::future_status::ready);
+	std::future<Result<std::int32_t>> result = sent.get();
+	ASSERT_EQ(result.wait_for(2s), std::future_status::ready);
+	Result<std::int32_t> value = result.get();
+	ios.post([&] () { client.close(); });
+	thread.join();
+
+	ASSERT_TRUE(value) << value.error().format();
+	EXPECT_EQ(*value, 10);
+}
+
+TEST(UdpClientCompletionToken, strandHandlersRunOnTheStrand) {
+	FakeController controller;
+	controller.setInt32(1, 10);
+
+	asio::io_service ios;
+	asio::strand<asio::io_service::executor_type> strand{ios.get_executor()};
+	Client client{ios};
+	std::optional<Result<std::int32_t>> result;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		client.sendCommand(ReadInt32Var{1}, 1s, asio::bind_executor(strand, [&] (Result<std::int32_t> response) {
+			EXPECT_TRUE(strand.running_in_this_thread());
+			result = std::move(response);
+			client.close();
+		}));
+	});
+	ios.run();
+
+	ASSERT_TRUE(result);
+	ASSERT_TRUE(*result) << result->error().format();
+	EXPECT_EQ(**result, 10);
+}
+
+TEST(UdpClientCompletionToken, handlerExecutorIsKeptBusy) {
+	FakeController controller;
+	controller.setInt32(1, 10);
+
+	// The handler runs on another io_service, which must not run out of work while the command is in flight.
+	asio::io_service ios;
+	asio::io_service other;
+	Client client{ios};
+	std::thread other_thread;
+	std::thread::id other_thread_id;
+	std::optional<Result<std::int32_t>> result;
+	std::thread::id handler_thread;
+	Client::DeadlineToken safety = 0;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		client.sendCommand(ReadInt32Var{1}, 1s, asio::bind_executor(other.get_executor(), [&] (Result<std::int32_t> response) {
+			handler_thread = std::this_thread::get_id();
+			result = std::move(response);
+			ios.post([&] () {
+				client.cancelDeadline(safety);
+				client.close();
+			});
+		}));
+
+		// Without outstanding work, polling would stop the other io_service before the reply arrives.
+		other.poll();
+		EXPECT_FALSE(other.stopped());
+		other_thread = std::thread{[&] () { other.run(); }};
+		other_thread_id = other_thread.get_id();
+
+		// Make sure the test ends even if the handler is never invoked.
+		safety = client.scheduleDeadline(std::chrono::steady_clock::now() + 2s, [&] () { client.close(); });
+	});
+	ios.run();
+	other_thread.join();
+
+	ASSERT_TRUE(result);
+	ASSERT_TRUE(*result) << result->error().format();
+	EXPECT_EQ(**result, 10);
+	EXPECT_EQ(handler_thread, other_thread_id);
+}
+
+TEST(UdpClientCompletionToken, associatedAllocatorIsUsed) {
+	FakeController controller;
+
+	asio::io_service ios;
+	asio::strand<asio::io_service::executor_type> strand{ios.get_executor()};
+	Client client{ios};
+	std::size_t direct_allocations = 0;
+	std::size_t strand_allocations = 0;
+	int calls = 0;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+
+		// The session is allocated with the associated allocator.
+		client.sendCommand(ReadInt32Var{1}, 1s, countingHandler(direct_allocations, [&] (Result<std::int32_t> result) {
+			EXPECT_TRUE(result) << result.error().format();
+			if (++calls == 2) client.close();
+		}));
+		EXPECT_GT(direct_allocations, 0u);
+
+		// Dispatching to the strand uses it too, even though the strand wrapper is removed before the handler is invoked.
+		client.sendCommand(ReadInt32Var{2}, 1s, asio::bind_executor(strand, countingHandler(strand_allocations, [&] (Result<std::int32_t> result) {
+			EXPECT_TRUE(result) << result.error().format();
+			if (++calls == 2) client.close();
+		})));
+	});
+	ios.run();
+
+	EXPECT_EQ(calls, 2);
+	EXPECT_GT(strand_allocations, direct_allocations);
+}
+
+TEST(UdpClientCompletionToken, recyclingHandlersHaveARecyclingAllocator) {
+	int calls = 0;
+	auto handler = recycling([&] () { ++calls; });
+	static_assert(std::is_same<asio::associated_allocator_t<decltype(handler)>, RecyclingAllocator<void>>::value, "recycling handlers must have a RecyclingAllocator");
+
+	asio::io_service ios;
+	for (int i = 0; i < 10; ++i) ios.post(handler);
+	ios.run();
+	EXPECT_EQ(calls, 10);
+}
+
+}}}
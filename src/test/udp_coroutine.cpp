@@ -0,0 +1,118 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "commands.hpp"
+#include "udp/client.hpp"
+#include "udp/coroutine.hpp"
+#include "fake_controller.hpp"
+
+#include <asio/io_service.hpp>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <tuple>
+
+#ifndef DR_YASKAWA_HAS_COROUTINES
+#error "this test must be compiled with coroutine support"
+#endif
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+using namespace std::chrono_literals;
+
+namespace {
+	/// Coroutine that starts right away and is not awaited by anyone.
+	struct Task {
+		struct promise_type : RecyclingFrame {
+			Task get_return_object() { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception() { std::terminate(); }
+		};
+	};
+
+	// The ASSERT macros return from the function, which a coroutine can not do.
+	Task sendCommands(Client & client, bool & finished) {
+		Result<void> written = co_await asyncSendCommand(client, WriteInt32Var{3, 30}, 1s);
+		EXPECT_TRUE(written) << written.error().format();
+
+		Result<std::int32_t> value = co_await asyncSendCommand(client, ReadInt32Var{3}, 1s);
+		EXPECT_TRUE(value) << value.error().format();
+		if (value) {
+			EXPECT_EQ(*value, 30);
+		}
+
+		auto values = co_await asyncSendCommands(client, std::make_tuple(ReadInt32Var{3}, ReadInt32Var{4}), 1s);
+		EXPECT_TRUE(values) << values.error().format();
+		if (values) {
+			EXPECT_EQ(*values, std::make_tuple(30, 40));
+		}
+
+		// The controller does not answer file requests.
+		Result<std::string> file = co_await asyncReadFile(client, "JOB.JBI", 50ms);
+		EXPECT_FALSE(file);
+		if (!file) {
+			EXPECT_EQ(file.error().code(), std::errc::timed_out);
+		}
+
+		finished = true;
+		client.close();
+	}
+}
+
+TEST(UdpClientCoroutine, awaitCommands) {
+	FakeController controller;
+	controller.setInt32(4, 40);
+	controller.ignore(0);
+
+	asio::io_service ios;
+	Client client{ios};
+	bool finished = false;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		sendCommands(client, finished);
+	});
+	ios.run();
+
+	EXPECT_TRUE(finished);
+	EXPECT_EQ(controller.int32(3), 30);
+}
+
+}}}
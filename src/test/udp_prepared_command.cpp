@@ -0,0 +1,112 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "commands.hpp"
+#include "udp/client.hpp"
+#include "udp/prepared_command.hpp"
+#include "udp/protocol.hpp"
+#include "fake_controller.hpp"
+
+#include <asio/io_service.hpp>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+using namespace std::chrono_literals;
+
+template<typename Command>
+void expectSameEncoding(Command const & command) {
+	PreparedCommand<Command> prepared = prepare(command);
+
+	// Encode after some existing data, to check that only the request ID of the new datagram is patched.
+	std::vector<std::uint8_t> const prefix{1, 2, 3};
+	std::vector<std::uint8_t> output;
+	for (int request_id = 0; request_id < 256; ++request_id) {
+		std::vector<std::uint8_t> expected = prefix;
+		encode(expected, request_id, command);
+
+		output = prefix;
+		encode(output, request_id, prepared);
+		ASSERT_EQ(output, expected) << "request ID " << request_id;
+
+		for (std::size_t i = 0; i < prepared.encoded().size(); ++i) {
+			if (i == header_offset::request_id) continue;
+			ASSERT_EQ(output[prefix.size() + i], prepared.encoded()[i]) << "byte " << i << ", request ID " << request_id;
+		}
+	}
+}
+
+TEST(UdpPreparedCommand, encodingMatchesFreshlyEncodedCommand) {
+	expectSameEncoding(ReadInt32Var{3});
+	expectSameEncoding(ReadInt32Vars{10, 4});
+	expectSameEncoding(WriteInt32Vars{10, {1, -2, 3, -4}});
+}
+
+TEST(UdpPreparedCommand, sendSamePreparedCommandManyTimes) {
+	FakeController controller;
+	for (int i = 0; i < 4; ++i) controller.setInt32(10 + i, 100 + i);
+
+	asio::io_service ios;
+	Client client{ios};
+
+	// Send all commands at once, so each send gets a different request ID.
+	constexpr int count = 100;
+	PreparedCommand<ReadInt32Vars> command = prepare(ReadInt32Vars{10, 4});
+	int done = 0;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		for (int i = 0; i < count; ++i) {
+			client.sendCommand(command, 1s, [&] (Result<std::vector<std::int32_t>> result) {
+				ASSERT_TRUE(result) << result.error().format();
+				EXPECT_EQ(*result, (std::vector<std::int32_t>{100, 101, 102, 103}));
+				if (++done == count) client.close();
+			});
+		}
+		EXPECT_EQ(client.inFlight(), std::size_t(count));
+	});
+	ios.run();
+
+	EXPECT_EQ(done, count);
+	ASSERT_EQ(controller.requests().size(), std::size_t(count));
+	for (FakeController::Request const & request : controller.requests()) {
+		EXPECT_EQ(request.instance, 10);
+		EXPECT_EQ(request.count, 4u);
+	}
+}
+
+}}}
@@ -0,0 +1,158 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "commands.hpp"
+#include "udp/client.hpp"
+#include "fake_controller.hpp"
+
+#include <asio/io_service.hpp>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+using namespace std::chrono_literals;
+
+namespace {
+	/// Register a handler for a free request ID, so it can be reported lost.
+	Client::HandlerToken openRequest(Client & client) {
+		std::optional<std::uint8_t> request_id = client.allocateId();
+		EXPECT_TRUE(request_id);
+		return client.registerHandler(*request_id, [] (ResponseHeader const &, std::string_view, ReceiveBuffer const &) {});
+	}
+}
+
+TEST(UdpClientRtt, timeoutFollowsRfc6298) {
+	asio::io_service ios;
+	Client client{ios};
+
+	// Without samples, the timeout is the upper bound.
+	EXPECT_EQ(client.smoothedRtt(), 0ms);
+	EXPECT_EQ(client.retransmissionTimeout(), client.maxAdaptiveTimeout());
+
+	// The first sample sets SRTT = R and RTTVAR = R / 2.
+	client.updateRttEstimate(100ms);
+	EXPECT_EQ(client.smoothedRtt(), 100ms);
+	EXPECT_EQ(client.rttVariation(), 50ms);
+	EXPECT_EQ(client.retransmissionTimeout(), 300ms);
+
+	// Later samples update RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R| and SRTT = 7/8 SRTT + 1/8 R.
+	client.updateRttEstimate(200ms);
+	EXPECT_EQ(client.rttVariation(), 62500us);
+	EXPECT_EQ(client.smoothedRtt(), 112500us);
+	EXPECT_EQ(client.retransmissionTimeout(), 362500us);
+
+	// The timeout is clamped to the configured limits.
+	client.setAdaptiveTimeoutLimits(10ms, 200ms);
+	EXPECT_EQ(client.retransmissionTimeout(), 200ms);
+
+	client.resetRttEstimate();
+	client.updateRttEstimate(1ms);
+	EXPECT_EQ(client.retransmissionTimeout(), 10ms);
+
+	EXPECT_THROW(client.setAdaptiveTimeoutLimits(2s, 1s), std::invalid_argument);
+}
+
+TEST(UdpClientRtt, lossBacksOffOncePerTimeoutUntilValidSample) {
+	asio::io_service ios;
+	Client client{ios};
+
+	client.updateRttEstimate(100ms);
+	ASSERT_EQ(client.retransmissionTimeout(), 300ms);
+
+	// Losses within the same timeout period only double the timeout once.
+	client.reportLoss(openRequest(client));
+	EXPECT_EQ(client.retransmissionTimeout(), 600ms);
+	client.reportLoss(openRequest(client));
+	EXPECT_EQ(client.retransmissionTimeout(), 600ms);
+
+	// A valid sample resets the backoff.
+	client.updateRttEstimate(100ms);
+	EXPECT_EQ(client.retransmissionTimeout(), 100ms + 4 * 37500us);
+}
+
+TEST(UdpClientRtt, backoffIsCappedAtMaximum) {
+	asio::io_service ios;
+	Client client{ios};
+
+	client.setAdaptiveTimeoutLimits(1ms, 20ms);
+	client.updateRttEstimate(2ms);
+	ASSERT_EQ(client.retransmissionTimeout(), 6ms);
+
+	client.reportLoss(openRequest(client));
+	EXPECT_EQ(client.retransmissionTimeout(), 12ms);
+
+	// Wait for the next timeout period, so the timeout doubles again.
+	std::this_thread::sleep_for(13ms);
+	client.reportLoss(openRequest(client));
+	EXPECT_EQ(client.retransmissionTimeout(), 20ms);
+}
+
+TEST(UdpClientRtt, repliesToLostRequestsAreNoSample) {
+	FakeController controller;
+	asio::io_service ios;
+	Client client{ios};
+
+	RetryPolicy retry;
+	retry.attempt_timeout = 20ms;
+	retry.max_retries     = 2;
+
+	// The first attempt is dropped, so the reply can not be matched to a transmission (Karn's algorithm).
+	controller.dropNext(1);
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		client.sendCommand(ReadInt32Var{0}, 1s, retry, [&] (Result<std::int32_t> result) {
+			ASSERT_TRUE(result) << result.error().format();
+			EXPECT_EQ(client.smoothedRtt(), 0ms);
+
+			// A reply to a request that was not lost is a valid sample.
+			client.sendCommand(ReadInt32Var{0}, 1s, retry, [&] (Result<std::int32_t> result) {
+				ASSERT_TRUE(result) << result.error().format();
+				EXPECT_GT(client.smoothedRtt(), 0ms);
+				client.close();
+			});
+		});
+	});
+	ios.run();
+	EXPECT_EQ(controller.requests().size(), 3u);
+}
+
+}}}
@@ -0,0 +1,268 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "commands.hpp"
+#include "udp/client.hpp"
+#include "udp/message.hpp"
+#include "fake_controller.hpp"
+
+#include <asio/io_service.hpp>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+using namespace std::chrono_literals;
+
+namespace {
+	/// Send commands with sendCommands() and wait for the result.
+	template<typename... Commands>
+	MultiCommandResult<std::tuple<Commands...>> sendCommands(FakeController & controller, std::tuple<Commands...> commands) {
+		asio::io_service ios;
+		Client client{ios};
+		std::optional<MultiCommandResult<std::tuple<Commands...>>> result;
+		client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+			ASSERT_FALSE(error) << error.format();
+			client.sendCommands(std::move(commands), 1s, [&] (MultiCommandResult<std::tuple<Commands...>> response) {
+				result = std::move(response);
+				EXPECT_EQ(client.inFlight(), 0u);
+				client.close();
+			});
+		});
+		ios.run();
+		if (!result) return Error{std::errc::timed_out, "no result"};
+		return std::move(*result);
+	}
+}
+
+TEST(UdpClientSendCommands, adjacentVariablesAreFused) {
+	FakeController controller;
+	controller.setInt32(1, 10);
+	controller.setInt32(2, 20);
+	controller.setInt32(3, 30);
+
+	auto result = sendCommands(controller, std::make_tuple(ReadInt32Var{1}, ReadInt32Var{2}, ReadInt32Var{3}));
+	ASSERT_TRUE(result) << result.error().format();
+	EXPECT_EQ(*result, std::make_tuple(10, 20, 30));
+
+	std::vector<FakeController::Request> requests = controller.requests();
+	ASSERT_EQ(requests.size(), 1u);
+	EXPECT_EQ(requests[0].service, service::read_multiple);
+	EXPECT_EQ(requests[0].instance, 1);
+	EXPECT_EQ(requests[0].count, 3u);
+
+	// Writes are fused the same way.
+	controller.clearRequests();
+	ASSERT_TRUE(sendCommands(controller, std::make_tuple(WriteInt32Var{7, 70}, WriteInt32Var{8, 80})));
+	EXPECT_EQ(controller.int32(7), 70);
+	EXPECT_EQ(controller.int32(8), 80);
+	requests = controller.requests();
+	ASSERT_EQ(requests.size(), 1u);
+	EXPECT_EQ(requests[0].service, service::write_multiple);
+	EXPECT_EQ(requests[0].count, 2u);
+}
+
+TEST(UdpClientSendCommands, onlyAdjacentIndicesAreFused) {
+	FakeController controller;
+	controller.setInt32(1, 10);
+	controller.setInt32(3, 30);
+	controller.setInt32(4, 40);
+
+	auto result = sendCommands(controller, std::make_tuple(ReadInt32Var{1}, ReadInt32Var{3}, ReadInt32Var{4}));
+	ASSERT_TRUE(result) << result.error().format();
+	EXPECT_EQ(*result, std::make_tuple(10, 30, 40));
+
+	std::vector<FakeController::Request> requests = controller.requests();
+	ASSERT_EQ(requests.size(), 2u);
+	std::sort(requests.begin(), requests.end(), [] (auto const & a, auto const & b) { return a.instance < b.instance; });
+	EXPECT_EQ(requests[0].service, service::get_all);
+	EXPECT_EQ(requests[0].instance, 1);
+	EXPECT_EQ(requests[1].service, service::read_multiple);
+	EXPECT_EQ(requests[1].instance, 3);
+	EXPECT_EQ(requests[1].count, 2u);
+}
+
+TEST(UdpClientSendCommands, byteVariablesAreNotFused) {
+	FakeController controller;
+
+	// A fused request for two B variables would be valid, but a run of three would not.
+	auto result = sendCommands(controller, std::make_tuple(ReadUint8Var{1}, ReadUint8Var{2}, ReadUint8Var{3}));
+	ASSERT_TRUE(result) << result.error().format();
+
+	std::vector<FakeController::Request> requests = controller.requests();
+	ASSERT_EQ(requests.size(), 3u);
+	for (FakeController::Request const & request : requests) EXPECT_EQ(request.service, service::get_all);
+}
+
+TEST(UdpClientSendCommands, fusedRunsAreSplitAtMaximumCount) {
+	FakeController controller;
+
+	// At most 9 position variables fit in one request.
+	auto result = sendCommands(controller, std::make_tuple(
+		ReadPositionVar{0}, ReadPositionVar{1}, ReadPositionVar{2}, ReadPositionVar{3}, ReadPositionVar{4},
+		ReadPositionVar{5}, ReadPositionVar{6}, ReadPositionVar{7}, ReadPositionVar{8}, ReadPositionVar{9}
+	));
+	ASSERT_TRUE(result) << result.error().format();
+
+	std::vector<FakeController::Request> requests = controller.requests();
+	ASSERT_EQ(requests.size(), 2u);
+	std::sort(requests.begin(), requests.end(), [] (auto const & a, auto const & b) { return a.instance < b.instance; });
+	EXPECT_EQ(requests[0].service, service::read_multiple);
+	EXPECT_EQ(requests[0].instance, 0);
+	EXPECT_EQ(requests[0].count, 9u);
+	EXPECT_EQ(requests[1].service, service::get_all);
+	EXPECT_EQ(requests[1].instance, 9);
+}
+
+TEST(UdpClientSendCommands, failingFusedRunFailsAllCommands) {
+	FakeController controller;
+	controller.fail(5);
+
+	auto result = sendCommands(controller, std::make_tuple(ReadInt32Var{5}, ReadInt32Var{6}, ReadInt32Var{9}));
+	ASSERT_FALSE(result);
+	EXPECT_EQ(result.error().code(), make_error_code(errc::command_failed));
+
+	// Variables 5 and 6 were read with a single request.
+	EXPECT_EQ(controller.requests().size(), 2u);
+}
+
+TEST(UdpClientSendCommands, partialResultsKeepSucceededCommands) {
+	FakeController controller;
+	controller.setInt32(1, 10);
+	controller.setInt32(31, 310);
+	controller.setInt32(40, 400);
+	controller.fail(20);
+	controller.fail(30);
+
+	asio::io_service ios;
+	Client client{ios};
+	auto commands = std::make_tuple(ReadInt32Var{1}, ReadInt16Var{20}, ReadInt32Var{30}, ReadInt32Var{31}, ReadInt32Var{40});
+	std::optional<PartialCommandResult<decltype(commands)>> result;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		client.sendCommands(std::move(commands), 1s, partial_results, [&] (PartialCommandResult<decltype(commands)> response) {
+			result = std::move(response);
+			client.close();
+		});
+	});
+	ios.run();
+
+	ASSERT_TRUE(result);
+	ASSERT_TRUE(*result) << result->error().format();
+	auto & [first, single, fused_first, fused_second, last] = **result;
+
+	// The failing single command does not affect the others.
+	ASSERT_TRUE(first) << first.error().format();
+	EXPECT_EQ(*first, 10);
+	ASSERT_FALSE(single);
+	EXPECT_EQ(single.error().code(), make_error_code(errc::command_failed));
+	ASSERT_TRUE(last) << last.error().format();
+	EXPECT_EQ(*last, 400);
+
+	// A rejected fused request is sent again as separate commands, so only the bad variable fails.
+	ASSERT_FALSE(fused_first);
+	EXPECT_EQ(fused_first.error().code(), make_error_code(errc::command_failed));
+	ASSERT_TRUE(fused_second) << fused_second.error().format();
+	EXPECT_EQ(*fused_second, 310);
+	EXPECT_EQ(controller.requests().size(), 6u);
+}
+
+TEST(UdpClientSendCommands, partialResultsResendRejectedFusedWrites) {
+	FakeController controller;
+	controller.fail(50);
+
+	asio::io_service ios;
+	Client client{ios};
+	auto commands = std::make_tuple(WriteInt32Var{50, 500}, WriteInt32Var{51, 510});
+	std::optional<PartialCommandResult<decltype(commands)>> result;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		client.sendCommands(std::move(commands), 1s, partial_results, [&] (PartialCommandResult<decltype(commands)> response) {
+			result = std::move(response);
+			client.close();
+		});
+	});
+	ios.run();
+
+	ASSERT_TRUE(result);
+	ASSERT_TRUE(*result) << result->error().format();
+	auto & [rejected, written] = **result;
+	ASSERT_FALSE(rejected);
+	EXPECT_EQ(rejected.error().code(), make_error_code(errc::command_failed));
+	ASSERT_TRUE(written) << written.error().format();
+	EXPECT_EQ(controller.int32(51), 510);
+	EXPECT_EQ(controller.requests().size(), 3u);
+}
+
+TEST(UdpClientSendCommands, partialResultsCompleteAtTheDeadline) {
+	FakeController controller;
+	controller.setInt32(1, 10);
+	controller.setInt32(3, 30);
+	controller.ignore(2);
+
+	asio::io_service ios;
+	Client client{ios};
+	auto commands = std::make_tuple(ReadInt32Var{1}, ReadInt16Var{2}, ReadInt32Var{3});
+	std::optional<PartialCommandResult<decltype(commands)>> result;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		client.sendCommands(std::move(commands), 200ms, partial_results, [&] (PartialCommandResult<decltype(commands)> response) {
+			result = std::move(response);
+			EXPECT_EQ(client.inFlight(), 0u);
+			client.close();
+		});
+	});
+	ios.run();
+
+	ASSERT_TRUE(result);
+	ASSERT_TRUE(*result) << result->error().format();
+	auto & [first, ignored, last] = **result;
+
+	// The commands that were answered keep their values, the ignored command times out.
+	ASSERT_TRUE(first) << first.error().format();
+	EXPECT_EQ(*first, 10);
+	ASSERT_FALSE(ignored);
+	EXPECT_EQ(ignored.error().code(), std::errc::timed_out);
+	ASSERT_TRUE(last) << last.error().format();
+	EXPECT_EQ(*last, 30);
+}
+
+}}}
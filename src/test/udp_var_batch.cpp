@@ -0,0 +1,285 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "commands.hpp"
+#include "udp/client.hpp"
+#include "../udp/var_batch.hpp"
+#include "fake_controller.hpp"
+
+#include <asio/io_service.hpp>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <variant>
+#include <vector>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+using namespace std::chrono_literals;
+
+namespace {
+	using Entries = std::vector<std::size_t>;
+
+	template<typename T>
+	std::size_t typeIndex() {
+		return VarValue{T{}}.index();
+	}
+}
+
+TEST(UdpVarBatch, runsAreSortedAndMerged) {
+	std::vector<VarAccess> batch{
+		VarAccess::reading<std::int32_t>(5),
+		VarAccess::reading<std::int32_t>(3),
+		VarAccess::writing<std::int32_t>(4, 40),
+		VarAccess::reading<std::int32_t>(4),
+		VarAccess::reading<std::int16_t>(4),
+	};
+
+	std::vector<impl::VarRun> runs = impl::planRuns(batch);
+	ASSERT_EQ(runs.size(), 3u);
+
+	EXPECT_EQ(runs[0].type, typeIndex<std::int16_t>());
+	EXPECT_FALSE(runs[0].write);
+	EXPECT_EQ(runs[0].index, 4);
+	EXPECT_EQ(runs[0].count, 1u);
+	EXPECT_EQ(runs[0].entries, (Entries{4}));
+
+	EXPECT_EQ(runs[1].type, typeIndex<std::int32_t>());
+	EXPECT_FALSE(runs[1].write);
+	EXPECT_EQ(runs[1].index, 3);
+	EXPECT_EQ(runs[1].count, 3u);
+	EXPECT_EQ(runs[1].entries, (Entries{1, 3, 0}));
+
+	EXPECT_EQ(runs[2].type, typeIndex<std::int32_t>());
+	EXPECT_TRUE(runs[2].write);
+	EXPECT_EQ(runs[2].index, 4);
+	EXPECT_EQ(runs[2].count, 1u);
+	EXPECT_EQ(runs[2].entries, (Entries{2}));
+}
+
+TEST(UdpVarBatch, duplicateReadsShareRun) {
+	std::vector<VarAccess> batch{
+		VarAccess::reading<std::int32_t>(7),
+		VarAccess::reading<std::int32_t>(8),
+		VarAccess::reading<std::int32_t>(7),
+	};
+
+	std::vector<impl::VarRun> runs = impl::planRuns(batch);
+	ASSERT_EQ(runs.size(), 1u);
+	EXPECT_EQ(runs[0].index, 7);
+	EXPECT_EQ(runs[0].count, 2u);
+	EXPECT_EQ(runs[0].entries, (Entries{0, 2, 1}));
+
+	// Writes of the same variable are never merged.
+	batch = {
+		VarAccess::writing<std::int32_t>(7, 1),
+		VarAccess::writing<std::int32_t>(7, 2),
+	};
+	runs = impl::planRuns(batch);
+	ASSERT_EQ(runs.size(), 2u);
+	EXPECT_EQ(runs[0].count, 1u);
+	EXPECT_EQ(runs[1].count, 1u);
+}
+
+TEST(UdpVarBatch, runsAreSplitAtMaximumCount) {
+	std::vector<VarAccess> batch;
+	for (std::uint16_t i = 0; i < 119; ++i) batch.push_back(VarAccess::reading<std::int32_t>(i));
+
+	std::vector<impl::VarRun> runs = impl::planRuns(batch);
+	ASSERT_EQ(runs.size(), 2u);
+	EXPECT_EQ(runs[0].index, 0);
+	EXPECT_EQ(runs[0].count, 118u);
+	EXPECT_EQ(runs[1].index, 118);
+	EXPECT_EQ(runs[1].count, 1u);
+}
+
+TEST(UdpVarBatch, oddByteRunsAreSplit) {
+	std::vector<VarAccess> batch{
+		VarAccess::reading<std::uint8_t>(1),
+		VarAccess::reading<std::uint8_t>(2),
+		VarAccess::reading<std::uint8_t>(3),
+		VarAccess::reading<std::uint8_t>(3),
+	};
+
+	std::vector<impl::VarRun> runs = impl::planRuns(batch);
+	ASSERT_EQ(runs.size(), 2u);
+	EXPECT_EQ(runs[0].index, 1);
+	EXPECT_EQ(runs[0].count, 2u);
+	EXPECT_EQ(runs[0].entries, (Entries{0, 1}));
+
+	// Both reads of the last variable move to the new run.
+	EXPECT_EQ(runs[1].index, 3);
+	EXPECT_EQ(runs[1].count, 1u);
+	EXPECT_EQ(runs[1].entries, (Entries{2, 3}));
+}
+
+TEST(UdpVarBatch, batchIsSentAsRuns) {
+	FakeController controller;
+	controller.setInt32(1, 10);
+	controller.setInt32(2, 20);
+
+	asio::io_service ios;
+	Client client{ios};
+	std::optional<Result<std::vector<VarValue>>> result;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		std::vector<VarAccess> batch{
+			VarAccess::reading<std::int32_t>(2),
+			VarAccess::writing<std::int32_t>(3, 30),
+			VarAccess::reading<std::int32_t>(1),
+			VarAccess::reading<std::int32_t>(2),
+		};
+		client.sendVarBatch(std::move(batch), 1s, [&] (Result<std::vector<VarValue>> response) {
+			result = std::move(response);
+			client.close();
+		});
+	});
+	ios.run();
+
+	ASSERT_TRUE(result);
+	ASSERT_TRUE(*result) << result->error().format();
+	std::vector<VarValue> const & values = **result;
+	ASSERT_EQ(values.size(), 4u);
+	EXPECT_EQ(std::get<std::int32_t>(values[0]), 20);
+	EXPECT_EQ(std::get<std::int32_t>(values[1]), 30);
+	EXPECT_EQ(std::get<std::int32_t>(values[2]), 10);
+	EXPECT_EQ(std::get<std::int32_t>(values[3]), 20);
+	EXPECT_EQ(controller.int32(3), 30);
+
+	// One read of variables 1 and 2, and one write of variable 3.
+	EXPECT_EQ(controller.requests().size(), 2u);
+}
+
+TEST(UdpVarBatch, singleAndOddByteRunsAreAccepted) {
+	FakeController controller;
+	for (std::uint16_t i = 0; i < 4; ++i) controller.setUint8(10 + i, 10 + i);
+
+	asio::io_service ios;
+	Client client{ios};
+	std::optional<Result<std::vector<VarValue>>> result;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		std::vector<VarAccess> batch{
+			VarAccess::reading<std::uint8_t>(10),
+			VarAccess::reading<std::uint8_t>(20),
+			VarAccess::reading<std::uint8_t>(11),
+			VarAccess::reading<std::uint8_t>(12),
+			VarAccess::writing<std::uint8_t>(30, 7),
+		};
+		client.sendVarBatch(std::move(batch), 1s, [&] (Result<std::vector<VarValue>> response) {
+			result = std::move(response);
+			client.close();
+		});
+	});
+	ios.run();
+
+	ASSERT_TRUE(result);
+	ASSERT_TRUE(*result) << result->error().format();
+	std::vector<VarValue> const & values = **result;
+	ASSERT_EQ(values.size(), 5u);
+	EXPECT_EQ(std::get<std::uint8_t>(values[0]), 10);
+	EXPECT_EQ(std::get<std::uint8_t>(values[1]), 0);
+	EXPECT_EQ(std::get<std::uint8_t>(values[2]), 11);
+	EXPECT_EQ(std::get<std::uint8_t>(values[3]), 12);
+	EXPECT_EQ(std::get<std::uint8_t>(values[4]), 7);
+	EXPECT_EQ(controller.uint8(30), 7);
+
+	// Variables 10 and 11 are read together, variables 12 and 20 and the write each on their own.
+	std::vector<FakeController::Request> requests = controller.requests();
+	ASSERT_EQ(requests.size(), 4u);
+	for (FakeController::Request const & request : requests) {
+		if (request.instance == 10) {
+			EXPECT_EQ(request.command, commands::robot::readwrite_multiple_int8);
+			EXPECT_EQ(request.count, 2u);
+		} else {
+			EXPECT_EQ(request.command, commands::robot::readwrite_int8_variable);
+			EXPECT_EQ(request.count, 1u);
+		}
+	}
+}
+
+TEST(UdpVarBatch, failingRunCancelsTheOthers) {
+	FakeController controller;
+	controller.fail(10);
+	controller.ignore(20);
+
+	asio::io_service ios;
+	Client client{ios};
+	std::optional<Result<std::vector<VarValue>>> result;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		std::vector<VarAccess> batch{
+			VarAccess::reading<std::int32_t>(10),
+			VarAccess::reading<std::int32_t>(20),
+		};
+		client.sendVarBatch(std::move(batch), 1s, [&] (Result<std::vector<VarValue>> response) {
+			// The ignored request no longer occupies a request ID or a deadline.
+			EXPECT_EQ(client.inFlight(), 0u);
+			EXPECT_EQ(client.pendingDeadlines(), 0u);
+			result = std::move(response);
+			client.close();
+		});
+	});
+	ios.run();
+
+	ASSERT_TRUE(result);
+	ASSERT_FALSE(*result);
+	EXPECT_EQ(result->error().code(), make_error_code(errc::command_failed));
+}
+
+TEST(UdpVarBatch, emptyBatchCompletesAsynchronously) {
+	FakeController controller;
+	asio::io_service ios;
+	Client client{ios};
+	std::optional<Result<std::vector<VarValue>>> result;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		client.sendVarBatch({}, 1s, [&] (Result<std::vector<VarValue>> response) {
+			result = std::move(response);
+			client.close();
+		});
+		EXPECT_FALSE(result);
+	});
+	ios.run();
+
+	ASSERT_TRUE(result);
+	ASSERT_TRUE(*result) << result->error().format();
+	EXPECT_TRUE((*result)->empty());
+	EXPECT_EQ(controller.requests().size(), 0u);
+}
+
+}}}
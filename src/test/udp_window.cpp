@@ -0,0 +1,200 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "commands.hpp"
+#include "udp/client.hpp"
+#include "fake_controller.hpp"
+
+#include <asio/io_service.hpp>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+using namespace std::chrono_literals;
+
+namespace {
+	/// Send commands one after the other, calling a function after each reply.
+	void sendSequentially(Client & client, int count, std::function<void()> on_reply) {
+		if (count == 0) return client.close();
+		client.sendCommand(ReadInt32Var{0}, 1s, [&client, count, on_reply] (Result<std::int32_t> result) {
+			ASSERT_TRUE(result) << result.error().format();
+			on_reply();
+			sendSequentially(client, count - 1, on_reply);
+		});
+	}
+}
+
+TEST(UdpClientWindow, adaptiveWindowGrowsWithReplies) {
+	FakeController controller;
+	controller.setDelay(20ms);
+	asio::io_service ios;
+	Client client{ios};
+
+	client.setAdaptiveWindow(true);
+	ASSERT_EQ(client.window(), 4u);
+
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		sendSequentially(client, 12, [] () {});
+	});
+	ios.run();
+
+	// With a stable round trip time, slow start adds one request per reply.
+	EXPECT_GT(client.window(), 8u);
+}
+
+TEST(UdpClientWindow, windowIsHalvedOncePerLoss) {
+	FakeController controller;
+	controller.setSilent(true);
+	asio::io_service ios;
+	Client client{ios};
+
+	client.setAdaptiveWindow(true);
+	ASSERT_EQ(client.window(), 4u);
+
+	int timeouts = 0;
+	std::vector<std::size_t> windows;
+	std::function<void (Result<std::int32_t>)> on_timeout = [&] (Result<std::int32_t> result) {
+		ASSERT_FALSE(result);
+		EXPECT_EQ(result.error().code(), std::errc::timed_out);
+		windows.push_back(client.window());
+
+		// Requests sent after the decrease belong to a new loss epoch.
+		if (++timeouts < 6 && timeouts >= 4) {
+			client.sendCommand(ReadInt32Var{0}, 50ms, on_timeout);
+		} else if (timeouts == 6) {
+			client.close();
+		}
+	};
+
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+
+		// All requests in the window are lost at once, which should only halve the window once.
+		for (std::uint16_t i = 0; i < 4; ++i) client.sendCommand(ReadInt32Var{i}, 50ms, on_timeout);
+		EXPECT_EQ(client.inFlight(), 4u);
+	});
+	ios.run();
+
+	// The window never drops below a single request.
+	EXPECT_EQ(windows, (std::vector<std::size_t>{2, 2, 2, 2, 1, 1}));
+}
+
+TEST(UdpClientWindow, windowIsClampedToMaxInFlight) {
+	FakeController controller;
+	controller.setDelay(1ms);
+	asio::io_service ios;
+	Client client{ios};
+
+	client.setMaxInFlight(0);
+	EXPECT_EQ(client.maxInFlight(), 1u);
+	client.setMaxInFlight(1000);
+	EXPECT_EQ(client.maxInFlight(), 255u);
+
+	client.setMaxInFlight(6);
+	client.setAdaptiveWindow(true);
+
+	std::size_t max_window    = 0;
+	std::size_t max_in_flight = 0;
+	auto record = [&] () {
+		max_window    = std::max(max_window, client.window());
+		max_in_flight = std::max(max_in_flight, client.inFlight());
+	};
+
+	int replies = 0;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+
+		// Send a burst of commands, more than the window allows.
+		for (int i = 0; i < 40; ++i) {
+			client.sendCommand(ReadInt32Var{0}, 5s, [&] (Result<std::int32_t> result) {
+				ASSERT_TRUE(result) << result.error().format();
+				record();
+				if (++replies == 40) sendSequentially(client, 20, record);
+			});
+			record();
+		}
+	});
+	ios.run();
+
+	EXPECT_EQ(replies, 40);
+	EXPECT_LE(max_window, 6u);
+	EXPECT_LE(max_in_flight, 6u);
+
+	// Lowering the limit also shrinks the current window.
+	client.setMaxInFlight(3);
+	EXPECT_LE(client.window(), 3u);
+}
+
+TEST(UdpClientWindow, repliesToLostRequestsAreNoSample) {
+	FakeController controller;
+	asio::io_service ios;
+	Client client{ios};
+
+	client.setAdaptiveWindow(true);
+	ASSERT_EQ(client.window(), 4u);
+
+	// The first attempt is reported lost long before the reply arrives.
+	controller.setDelay(200ms);
+	RetryPolicy retry_policy;
+	retry_policy.attempt_timeout = 20ms;
+	retry_policy.max_retries     = 1;
+
+	int calls = 0;
+	client.connect("127.0.0.1", controller.port(), 1s, [&] (Error error) {
+		ASSERT_FALSE(error) << error.format();
+		client.sendCommand(ReadInt32Var{0}, 5s, retry_policy, [&] (Result<std::int32_t> result) {
+			++calls;
+			ASSERT_TRUE(result) << result.error().format();
+
+			// The loss halved the window, and the ambiguous reply did not grow it again.
+			EXPECT_EQ(client.window(), 2u);
+			EXPECT_EQ(client.smoothedRtt(), std::chrono::steady_clock::duration::zero());
+			client.close();
+		});
+	});
+	ios.run();
+
+	EXPECT_EQ(calls, 1);
+}
+
+}}}
@@ -31,21 +31,49 @@
 #include "./write_file.hpp"
 
 #include "commands.hpp"
+#include "recycling_allocator.hpp"
 #include "udp/client.hpp"
 #include "udp/message.hpp"
 #include "udp/protocol.hpp"
 
+#include <algorithm>
 #include <atomic>
+#include <cerrno>
 #include <memory>
 #include <utility>
 
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
 namespace dr {
 namespace yaskawa {
 namespace udp {
 
+#ifdef __linux__
+struct Client::BatchReceiver {
+	/// Maximum number of datagrams to read with a single system call.
+	static constexpr std::size_t batch_size = 32;
+
+	std::array<ReceiveBuffer, batch_size> buffers;
+	std::array<::iovec, batch_size> iovecs;
+	std::array<::mmsghdr, batch_size> messages;
+};
+#else
+struct Client::BatchReceiver {};
+#endif
+
 Client::Client(asio::io_service & ios) :
 	socket_(ios),
-	read_buffer_{std::make_unique<std::array<std::uint8_t, 512>>()} {}
+	flush_timer_(ios),
+	deadline_timer_(ios)
+{
+	for (std::size_t i = 0; i < free_ids_.size(); ++i) free_ids_[i] = i + 1;
+	free_ids_count_ = free_ids_.size();
+}
+
+Client::~Client() = default;
 
 void Client::connect(std::string const & host, std::string const & port, std::chrono::milliseconds timeout, ErrorCallback callback) {
 	auto on_connect = [this, callback = std::move(callback)] (Error error) {
@@ -60,16 +88,412 @@ void Client::connect(std::string const & host, std::uint16_t port, std::chrono::
 
 void Client::close() {
 	socket_.close();
+
+	// Closing the socket aborts a pending wait for the socket to become writable,
+	// so schedule a new flush to report the error for the messages that are still queued.
+	if (!send_queue_.empty()) {
+		flush_scheduled_ = false;
+		scheduleFlush();
+	}
+}
+
+void Client::setBatchSend(bool enable) {
+#ifdef __linux__
+	batch_send_ = enable;
+	if (!enable) flushSendQueue();
+#else
+	(void) enable;
+#endif
+}
+
+Client::SendToken Client::send(asio::const_buffer data, SendErrorCallback on_error) {
+	if (!batch_send_) {
+		socket_.async_send(asio::buffer(data), recycling([on_error = std::move(on_error)] (std::error_code error, std::size_t) mutable {
+			if (error) on_error(error);
+		}));
+		return 0;
+	}
+
+	SendToken token = next_send_token_++;
+	send_queue_.push_back({token, data, std::move(on_error)});
+	scheduleFlush();
+	return token;
+}
+
+void Client::cancelSend(SendToken token) {
+	if (token == 0) return;
+	auto compare = [] (PendingSend const & message, SendToken token) { return message.token < token; };
+	auto message = std::lower_bound(send_queue_.begin(), send_queue_.end(), token, compare);
+	if (message == send_queue_.end() || message->token != token) return;
+
+	// The queue may be in the middle of a flush, so mark the message instead of removing it.
+	message->cancelled = true;
+	message->on_error  = nullptr;
+}
+
+void Client::scheduleFlush() {
+	if (flush_scheduled_) return;
+	flush_scheduled_ = true;
+
+	// Setting the expiry time cancels an earlier wait, so there is never more than one pending flush.
+	flush_timer_.expires_at(std::chrono::steady_clock::time_point::min());
+	flush_timer_.async_wait(recycling([this] (std::error_code error) {
+		// Don't touch the client for aborted waits: it may have been destroyed.
+		if (error == asio::error::operation_aborted) return;
+		flushSendQueue();
+	}));
+}
+
+void Client::flushSendQueue() {
+#ifdef __linux__
+	constexpr std::size_t batch_size = 64;
+	std::array<::iovec, batch_size> iovecs;
+	std::array<::mmsghdr, batch_size> messages;
+
+	// Position in the send queue of each message in the batch.
+	std::array<std::size_t, batch_size> indices;
+
+	// Handlers invoked from here may queue more messages, which are sent in the same flush.
+	// They may also cancel queued messages, which are skipped.
+	flush_scheduled_ = true;
+	std::size_t done = 0;
+	while (done < send_queue_.size()) {
+		if (send_queue_[done].cancelled) {
+			++done;
+			continue;
+		}
+
+		if (!socket_.is_open()) {
+			SendErrorCallback on_error = std::move(send_queue_[done++].on_error);
+			on_error(asio::error::bad_descriptor);
+			continue;
+		}
+
+		std::size_t count = 0;
+		for (std::size_t i = done; i < send_queue_.size() && count < batch_size; ++i) {
+			if (send_queue_[i].cancelled) continue;
+			asio::const_buffer const & data = send_queue_[i].data;
+			indices[count] = i;
+			iovecs[count] = {const_cast<void *>(data.data()), data.size()};
+			messages[count] = {};
+			messages[count].msg_hdr.msg_iov    = &iovecs[count];
+			messages[count].msg_hdr.msg_iovlen = 1;
+			++count;
+		}
+
+		int sent = ::sendmmsg(socket_.native_handle(), messages.data(), count, MSG_DONTWAIT);
+		if (sent > 0) {
+			done = indices[sent - 1] + 1;
+			continue;
+		}
+		if (sent < 0 && errno == EINTR) continue;
+
+		// Wait for the socket to become writable and continue where we left off.
+		if (sent == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
+			send_queue_.erase(send_queue_.begin(), send_queue_.begin() + done);
+			socket_.async_wait(Socket::wait_write, recycling([this] (std::error_code error) {
+				// Don't touch the client for aborted waits: it may have been destroyed.
+				// If the socket was closed instead, close() scheduled a new flush.
+				if (error == asio::error::operation_aborted) return;
+				flushSendQueue();
+			}));
+			return;
+		}
+
+		// Sending the first message failed, report the error and continue with the next message.
+		std::error_code error{errno, std::system_category()};
+		done = indices[0];
+		SendErrorCallback on_error = std::move(send_queue_[done++].on_error);
+		on_error(error);
+	}
+
+	send_queue_.clear();
+	flush_scheduled_ = false;
+#else
+	// Batch send mode is never enabled on other platforms.
+	flush_scheduled_ = false;
+#endif
+}
+
+void Client::setBatchReceive(bool enable) {
+	if (socket_.is_open()) throw std::logic_error("batch receive mode can not be changed while the client is connected");
+#ifdef __linux__
+	if (enable && !batch_receiver_) batch_receiver_ = std::make_unique<BatchReceiver>();
+	if (!enable) batch_receiver_ = nullptr;
+#else
+	(void) enable;
+#endif
 }
 
-Client::HandlerToken Client::registerHandler(std::uint8_t request_id, std::function<void(ResponseHeader const &, std::string_view)> handler) {
-	auto result = requests_.insert({request_id, {std::chrono::steady_clock::now(), handler}});
-	if (!result.second) throw std::logic_error("request_id " + std::to_string(request_id) + " is already taken, can not register handler");
-	return result.first;
+Client::HandlerToken Client::registerHandler(std::uint8_t request_id, ReplyHandler handler) {
+	OpenRequest & request = requests_[request_id];
+	if (!request.allocated) throw std::logic_error("request_id " + std::to_string(request_id) + " is not allocated, can not register handler");
+	if (request.active) throw std::logic_error("request_id " + std::to_string(request_id) + " is already taken, can not register handler");
+	request.start_time = std::chrono::steady_clock::now();
+	request.on_reply   = std::move(handler);
+	request.active     = true;
+	request.answered   = false;
+	request.lost       = false;
+	return {request_id, ++request.generation};
 }
 
 void Client::removeHandler(HandlerToken token) {
-	requests_.erase(token);
+	OpenRequest & request = requests_[token.request_id];
+	if (!request.active || request.generation != token.generation) return;
+	request.active = false;
+	request.on_reply = nullptr;
+	releaseId(token.request_id);
+}
+
+std::optional<std::uint8_t> Client::allocateId() {
+	if (free_ids_count_ == 0) return std::nullopt;
+	if (inFlight() >= std::max<std::size_t>(window(), 1)) return std::nullopt;
+	std::uint8_t request_id = free_ids_[free_ids_start_];
+	free_ids_start_ = (free_ids_start_ + 1) % free_ids_.size();
+	--free_ids_count_;
+	requests_[request_id].allocated = true;
+	return request_id;
+}
+
+void Client::releaseId(std::uint8_t request_id) {
+	OpenRequest & request = requests_[request_id];
+	if (request.active) throw std::logic_error("request_id " + std::to_string(request_id) + " still has a handler, can not release it");
+	if (!request.allocated) return;
+	request.allocated = false;
+	free_ids_[(free_ids_start_ + free_ids_count_) % free_ids_.size()] = request_id;
+	++free_ids_count_;
+	drainQueue();
+}
+
+Result<Client::QueueToken> Client::reserveId(IdCallback on_id) {
+	if (queue_.empty()) {
+		if (std::optional<std::uint8_t> request_id = allocateId()) {
+			on_id(*request_id);
+			return QueueToken{0};
+		}
+	}
+
+	if (queue_.size() >= max_queue_size_) return Error{std::errc::no_buffer_space, "submission queue is full"};
+	QueueToken token = next_queue_token_++;
+	queue_.push_back({token, std::move(on_id)});
+	return token;
+}
+
+void Client::cancelReservation(QueueToken token) {
+	if (token == 0) return;
+	auto compare = [] (QueuedRequest const & request, QueueToken token) { return request.token < token; };
+	auto request = std::lower_bound(queue_.begin(), queue_.end(), token, compare);
+	if (request != queue_.end() && request->token == token) queue_.erase(request);
+}
+
+void Client::setMaxInFlight(std::size_t max_in_flight) {
+	max_in_flight_ = std::clamp<std::size_t>(max_in_flight, 1, free_ids_.size());
+	window_threshold_ = std::min<double>(window_threshold_, max_in_flight_);
+	window_ = adaptive_window_ ? std::min<double>(window_, max_in_flight_) : max_in_flight_;
+	drainQueue();
+}
+
+void Client::setAdaptiveWindow(bool enable) {
+	adaptive_window_   = enable;
+	window_threshold_  = max_in_flight_;
+	min_rtt_           = std::chrono::steady_clock::duration::zero();
+	window_            = enable ? std::min<double>(4, max_in_flight_) : max_in_flight_;
+	drainQueue();
+}
+
+void Client::reportLoss(HandlerToken token) {
+	OpenRequest & request = requests_[token.request_id];
+	if (!request.active || request.generation != token.generation || request.answered) return;
+	request.lost = true;
+
+	// Back off the retransmission timeout, but only once per timeout period.
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (now - last_rtt_backoff_ >= retransmissionTimeout()) {
+		last_rtt_backoff_ = now;
+		rtt_backoff_ = std::min(rtt_backoff_ + 1, 16);
+	}
+
+	if (!adaptive_window_) return;
+
+	// Only shrink the window once for all requests sent before the last decrease.
+	if (request.start_time < last_window_decrease_) return;
+	last_window_decrease_ = now;
+	window_threshold_ = std::max(window_ / 2, 1.0);
+	window_ = window_threshold_;
+}
+
+std::chrono::steady_clock::duration Client::retransmissionTimeout() const {
+	if (smoothed_rtt_ == std::chrono::steady_clock::duration::zero()) return max_adaptive_timeout_;
+	std::chrono::steady_clock::duration timeout = std::max(smoothed_rtt_ + 4 * rtt_variation_, min_adaptive_timeout_);
+	return std::min(timeout * (1 << rtt_backoff_), max_adaptive_timeout_);
+}
+
+void Client::setAdaptiveTimeoutLimits(std::chrono::steady_clock::duration min, std::chrono::steady_clock::duration max) {
+	if (min > max) throw std::invalid_argument("minimum adaptive timeout can not be larger than the maximum");
+	min_adaptive_timeout_ = min;
+	max_adaptive_timeout_ = max;
+}
+
+void Client::resetRttEstimate() {
+	smoothed_rtt_  = std::chrono::steady_clock::duration::zero();
+	rtt_variation_ = std::chrono::steady_clock::duration::zero();
+	rtt_backoff_   = 0;
+}
+
+void Client::updateRttEstimate(std::chrono::steady_clock::duration rtt) {
+	// Jacobson/Karels estimator with the gains from RFC 6298 (alpha = 1/8, beta = 1/4).
+	if (smoothed_rtt_ == std::chrono::steady_clock::duration::zero()) {
+		smoothed_rtt_  = rtt;
+		rtt_variation_ = rtt / 2;
+	} else {
+		rtt_variation_ = (3 * rtt_variation_ + (smoothed_rtt_ > rtt ? smoothed_rtt_ - rtt : rtt - smoothed_rtt_)) / 4;
+		smoothed_rtt_  = (7 * smoothed_rtt_ + rtt) / 8;
+	}
+	rtt_backoff_ = 0;
+}
+
+void Client::onReply(std::chrono::steady_clock::duration rtt) {
+	if (!adaptive_window_) return;
+	if (min_rtt_ == std::chrono::steady_clock::duration::zero() || rtt < min_rtt_) min_rtt_ = rtt;
+
+	// Estimate the number of our requests queued at the controller from the extra delay (like TCP Vegas).
+	double queued = rtt.count() > 0 ? window_ * (1.0 - double(min_rtt_.count()) / double(rtt.count())) : 0;
+
+	if (queued > 3) {
+		// Back off slowly if requests are piling up.
+		window_threshold_ = std::max(window_ - 1, 1.0);
+		window_ = std::max(window_ - 1 / window_, 1.0);
+	} else if (queued > 1) {
+		// Hold the window.
+	} else if (window_ < window_threshold_) {
+		// Slow start: grow by one request per reply.
+		window_ = std::min<double>(window_ + 1, max_in_flight_);
+	} else {
+		// Congestion avoidance: grow by one request per window.
+		window_ = std::min<double>(window_ + 1 / window_, max_in_flight_);
+	}
+}
+
+void Client::drainQueue() {
+	while (!queue_.empty()) {
+		std::optional<std::uint8_t> request_id = allocateId();
+		if (!request_id) return;
+		IdCallback on_id = std::move(queue_.front().on_id);
+		queue_.pop_front();
+		on_id(*request_id);
+	}
+}
+
+// Deadlines.
+
+Client::DeadlineToken Client::scheduleDeadline(std::chrono::steady_clock::time_point time, DeadlineCallback on_expire) {
+	std::uint32_t slot;
+	if (free_deadlines_.empty()) {
+		slot = deadlines_.size();
+		deadlines_.emplace_back();
+	} else {
+		slot = free_deadlines_.back();
+		free_deadlines_.pop_back();
+	}
+
+	Deadline & deadline = deadlines_[slot];
+	deadline.time       = time;
+	deadline.on_expire  = std::move(on_expire);
+	deadline.heap_index = deadline_heap_.size();
+	deadline_heap_.push_back(slot);
+	restoreDeadlineHeap(deadline_heap_.size() - 1);
+
+	DeadlineToken token = DeadlineToken(deadlines_[slot].generation) << 32 | (slot + 1);
+	armDeadlineTimer();
+	return token;
+}
+
+void Client::cancelDeadline(DeadlineToken token) {
+	if (token == 0) return;
+	std::uint32_t slot       = (token & 0xffffffff) - 1;
+	std::uint32_t generation = token >> 32;
+	if (slot >= deadlines_.size() || deadlines_[slot].generation != generation) return;
+
+	// Keep the callback alive until the heap is consistent again,
+	// since destroying it may cancel other deadlines.
+	DeadlineCallback on_expire = removeDeadline(deadlines_[slot].heap_index);
+
+	// Stop waiting if there is nothing left to wait for, so the IO service can run out of work.
+	if (deadline_heap_.empty() && deadline_timer_expiry_ != std::chrono::steady_clock::time_point::max()) {
+		deadline_timer_expiry_ = std::chrono::steady_clock::time_point::max();
+		++deadline_timer_generation_;
+		deadline_timer_.cancel();
+	}
+}
+
+Client::DeadlineCallback Client::removeDeadline(std::size_t heap_index) {
+	std::uint32_t slot = deadline_heap_[heap_index];
+	swapDeadlines(heap_index, deadline_heap_.size() - 1);
+	deadline_heap_.pop_back();
+	if (heap_index < deadline_heap_.size()) restoreDeadlineHeap(heap_index);
+
+	Deadline & deadline = deadlines_[slot];
+	++deadline.generation;
+	free_deadlines_.push_back(slot);
+	return std::move(deadline.on_expire);
+}
+
+void Client::restoreDeadlineHeap(std::size_t heap_index) {
+	auto time = [this] (std::size_t index) {
+		return deadlines_[deadline_heap_[index]].time;
+	};
+
+	// Move up while the deadline is earlier than the parent.
+	while (heap_index > 0 && time(heap_index) < time((heap_index - 1) / 2)) {
+		swapDeadlines(heap_index, (heap_index - 1) / 2);
+		heap_index = (heap_index - 1) / 2;
+	}
+
+	// Move down while the deadline is later than one of the children.
+	while (true) {
+		std::size_t earliest = heap_index;
+		std::size_t left     = 2 * heap_index + 1;
+		std::size_t right    = 2 * heap_index + 2;
+		if (left  < deadline_heap_.size() && time(left)  < time(earliest)) earliest = left;
+		if (right < deadline_heap_.size() && time(right) < time(earliest)) earliest = right;
+		if (earliest == heap_index) return;
+		swapDeadlines(heap_index, earliest);
+		heap_index = earliest;
+	}
+}
+
+void Client::swapDeadlines(std::size_t a, std::size_t b) {
+	std::swap(deadline_heap_[a], deadline_heap_[b]);
+	deadlines_[deadline_heap_[a]].heap_index = a;
+	deadlines_[deadline_heap_[b]].heap_index = b;
+}
+
+void Client::armDeadlineTimer() {
+	if (deadline_heap_.empty()) return;
+
+	// If the pending wait expires earlier, it will rearm the timer when it expires.
+	std::chrono::steady_clock::time_point earliest = deadlines_[deadline_heap_.front()].time;
+	if (earliest >= deadline_timer_expiry_) return;
+
+	deadline_timer_expiry_ = earliest;
+	std::uint64_t generation = ++deadline_timer_generation_;
+	deadline_timer_.expires_at(earliest);
+	deadline_timer_.async_wait(recycling([this, generation] (std::error_code error) {
+		// Don't touch the client for aborted waits: it may have been destroyed.
+		if (error == asio::error::operation_aborted) return;
+		if (generation != deadline_timer_generation_) return;
+		deadline_timer_expiry_ = std::chrono::steady_clock::time_point::max();
+		onDeadlineTimer();
+	}));
+}
+
+void Client::onDeadlineTimer() {
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	while (!deadline_heap_.empty() && deadlines_[deadline_heap_.front()].time <= now) {
+		DeadlineCallback on_expire = removeDeadline(0);
+		on_expire();
+	}
+	armDeadlineTimer();
 }
 
 // File control.
@@ -80,7 +504,7 @@ void Client::readFileList(
 	std::function<void(Result<std::vector<std::string>>)> on_done,
 	std::function<void(std::size_t bytes_received)> on_progress
 ) {
-	impl::readFile(*this, request_id_++, ReadFileList{std::move(type)}, timeout, std::move(on_done), std::move(on_progress));
+	impl::readFile(*this, ReadFileList{std::move(type)}, std::chrono::steady_clock::now() + timeout, std::move(on_done), std::move(on_progress));
 }
 
 void Client::readFile(
@@ -89,7 +513,7 @@ void Client::readFile(
 	std::function<void(Result<std::string>)> on_done,
 	std::function<void(std::size_t bytes_received)> on_progress
 ) {
-	impl::readFile(*this, request_id_++, ReadFile{std::move(name)}, timeout, std::move(on_done), std::move(on_progress));
+	impl::readFile(*this, ReadFile{std::move(name)}, std::chrono::steady_clock::now() + timeout, std::move(on_done), std::move(on_progress));
 }
 
 void Client::writeFile(
@@ -99,7 +523,7 @@ void Client::writeFile(
 	std::function<void(Result<void>)> on_done,
 	std::function<void(std::size_t bytes_sent, std::size_t total_bytes)> on_progress
 ) {
-	impl::writeFile(*this, request_id_++, WriteFile{std::move(name), std::move(data)}, timeout, std::move(on_done), std::move(on_progress));
+	impl::writeFile(*this, WriteFile{std::move(name), std::move(data)}, std::chrono::steady_clock::now() + timeout, std::move(on_done), std::move(on_progress));
 }
 
 void Client::deleteFile(
@@ -121,8 +545,18 @@ void Client::receive() {
 	// Make sure we stop reading if the socket is closed.
 	// Otherwise in rare cases we can miss an operation_canceled and continue reading forever.
 	if (!socket_.is_open()) return;
+
+	// In batch receive mode, wait for the socket to become readable and read everything at once.
+	if (batch_receiver_) {
+		socket_.async_wait(Socket::wait_read, recycling(std::bind(&Client::onReadable, this, std::placeholders::_1)));
+		return;
+	}
+
+	// Get a new buffer if a handler kept the last one.
+	if (!read_buffer_ || read_buffer_.shared()) read_buffer_ = receive_buffers_.acquire();
+
 	auto callback = std::bind(&Client::onReceive, this, std::placeholders::_1, std::placeholders::_2);
-	socket_.async_receive(asio::buffer(read_buffer_->data(), read_buffer_->size()), callback);
+	socket_.async_receive(asio::buffer(read_buffer_.data(), read_buffer_.size()), recycling(callback));
 }
 
 void Client::onReceive(std::error_code error, std::size_t message_size) {
@@ -133,27 +567,84 @@ void Client::onReceive(std::error_code error, std::size_t message_size) {
 		return;
 	}
 
+	dispatch(read_buffer_, message_size);
+	receive();
+}
+
+void Client::onReadable(std::error_code error) {
+	if (error == std::errc::operation_canceled) return;
+	if (error) {
+		if (on_error) on_error(make_error_code(std::errc(error.value())));
+		receive();
+		return;
+	}
+
+#ifdef __linux__
+	BatchReceiver & batch = *batch_receiver_;
+	while (socket_.is_open()) {
+		// Replace buffers kept by handlers and reset the message headers, since recvmmsg modifies them.
+		for (std::size_t i = 0; i < batch.messages.size(); ++i) {
+			if (!batch.buffers[i] || batch.buffers[i].shared()) batch.buffers[i] = receive_buffers_.acquire();
+			batch.iovecs[i] = {batch.buffers[i].data(), batch.buffers[i].size()};
+			batch.messages[i] = {};
+			batch.messages[i].msg_hdr.msg_iov    = &batch.iovecs[i];
+			batch.messages[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int count = ::recvmmsg(socket_.native_handle(), batch.messages.data(), batch.messages.size(), MSG_DONTWAIT, nullptr);
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK && on_error) on_error(Error{std::error_code{errno, std::system_category()}, "receiving messages"});
+			break;
+		}
+
+		for (int i = 0; i < count; ++i) {
+			// A handler may have closed the socket (and disabled batch receive mode).
+			if (!socket_.is_open()) return;
+			dispatch(batch.buffers[i], batch.messages[i].msg_len);
+		}
+
+		// A partial batch means the socket is drained.
+		if (std::size_t(count) < BatchReceiver::batch_size) break;
+	}
+#endif
+
+	receive();
+}
+
+void Client::dispatch(ReceiveBuffer const & buffer, std::size_t message_size) {
 	// Decode the response header.
-	std::string_view message{reinterpret_cast<char const *>(read_buffer_->data()), message_size};
+	std::string_view message = buffer.view(message_size);
 	Result<ResponseHeader> header = decodeResponseHeader(message);
 	if (!header) {
 		if (on_error) on_error(header.error());
-		receive();
 		return;
 	}
 
 	// Find the right handler for the response.
-	auto handler = requests_.find(header->request_id);
-	if (handler == requests_.end()) {
+	OpenRequest & request = requests_[header->request_id];
+	if (!request.active) {
 		if (on_error) on_error({errc::unknown_request, "no handler for request id " + std::to_string(header->request_id)});
-		receive();
 		return;
 	}
 
-	// Invoke the handler (a copy, so it can erase itself safely).
-	auto callback = handler->second.on_reply;
-	callback(*header, message);
-	receive();
+	// Update the round trip time estimate and the adaptive window with the first reply.
+	// Replies to requests that were reported lost are ambiguous, so they are not used as sample.
+	if (!request.answered) {
+		request.answered = true;
+		if (!request.lost) {
+			std::chrono::steady_clock::duration rtt = std::chrono::steady_clock::now() - request.start_time;
+			updateRttEstimate(rtt);
+			onReply(rtt);
+		}
+	}
+
+	// Move the handler out of the table while invoking it, so it can remove itself safely.
+	// Put it back afterwards if it is still registered.
+	std::uint32_t generation = request.generation;
+	ReplyHandler callback = std::move(request.on_reply);
+	callback(*header, message, buffer);
+	if (request.active && request.generation == generation) request.on_reply = std::move(callback);
 }
 
 }}}
@@ -0,0 +1,115 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "commands.hpp"
+#include "udp/cancellation.hpp"
+#include "udp/client.hpp"
+#include "./read_file.hpp"
+#include "./write_file.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+namespace {
+	/// Shared state of a batch of commands.
+	struct CommandBatchState {
+		std::vector<AnyResponse> results;
+		std::size_t remaining;
+		bool done = false;
+		Client::BatchCallback callback;
+
+		/// Signal connected to the sessions of all commands in the batch.
+		CancellationSignal sessions;
+
+		void resolve(Result<std::vector<AnyResponse>> result) {
+			if (done) return;
+			done = true;
+
+			// Stop the commands that are still running, so they don't outlive the batch.
+			sessions.cancel();
+			callback(std::move(result));
+		}
+
+		/// Store the response of a command and resolve the batch if it was the last one.
+		template<typename Response>
+		void finish(std::size_t index, Result<Response> result) {
+			if (!result) return resolve(result.error_unchecked());
+			if constexpr (!std::is_void<Response>::value) {
+				results[index].emplace<Response>(std::move(*result));
+			}
+			if (--remaining == 0) resolve(std::move(results));
+		}
+	};
+
+	/// Send a single command of a batch.
+	template<typename Command>
+	void sendBatchCommand(Client & client, Command command, std::chrono::steady_clock::time_point deadline, std::shared_ptr<CommandBatchState> const & state, std::size_t index) {
+		auto callback = [state, index] (Result<typename Command::Response> result) {
+			state->finish(index, std::move(result));
+		};
+
+		// File transfers use the deadline of the batch as their end time.
+		if constexpr (std::is_same<Command, ReadFileList>::value || std::is_same<Command, ReadFile>::value) {
+			state->sessions.connect(impl::readFile(client, std::move(command), deadline, std::move(callback), nullptr));
+		} else if constexpr (std::is_same<Command, WriteFile>::value) {
+			state->sessions.connect(impl::writeFile(client, std::move(command), deadline, std::move(callback), nullptr));
+		} else {
+			client.sendCommand(std::move(command), deadline, bindCancellation(state->sessions, std::move(callback)));
+		}
+	}
+}
+
+void Client::sendBatch(std::vector<AnyCommand> commands, std::chrono::steady_clock::time_point deadline, BatchCallback callback) {
+	auto state = std::make_shared<CommandBatchState>();
+	state->results   = std::vector<AnyResponse>(commands.size());
+	state->remaining = commands.size();
+	state->callback  = std::move(callback);
+
+	// Report an empty batch asynchronously, like any other result.
+	if (commands.empty()) {
+		ios().post([state] () { state->resolve(std::vector<AnyResponse>{}); });
+		return;
+	}
+
+	for (std::size_t i = 0; i < commands.size(); ++i) {
+		std::visit([&] (auto & command) {
+			sendBatchCommand(*this, std::move(command), deadline, state, i);
+		}, commands[i]);
+	}
+}
+
+}}}
@@ -32,6 +32,7 @@
 #include "udp/message.hpp"
 
 #include <cstdint>
+#include <cstring>
 #include <string>
 #include <string_view>
 #include <type_traits>
@@ -59,6 +60,28 @@ T readLittleEndian(std::string_view & data) {
 	return readLittleEndian<T>(reinterpret_cast<std::uint8_t const *>(data.data() - sizeof(T)));
 }
 
+/// Read an array of little-endian integral or floating point values from a byte buffer.
+/**
+ * On little-endian hosts the whole array is copied with a single memcpy.
+ */
+template<typename T>
+void readLittleEndianArray(std::uint8_t const * data, std::size_t count, T * out) {
+	static_assert(std::is_arithmetic<T>::value, "T must be an arithmetic type.");
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	std::memcpy(out, data, count * sizeof(T));
+#else
+	using Unsigned = std::make_unsigned_t<std::conditional_t<std::is_floating_point<T>::value, std::int32_t, T>>;
+	static_assert(sizeof(Unsigned) == sizeof(T), "unsupported floating point type");
+	for (std::size_t i = 0; i < count; ++i) {
+		Unsigned value = 0;
+		for (unsigned int byte = 0; byte < sizeof(T); ++byte) {
+			value |= Unsigned(data[i * sizeof(T) + byte]) << byte * 8;
+		}
+		std::memcpy(out + i, &value, sizeof(T));
+	}
+#endif
+}
+
 /// Decode a response header.
 Result<ResponseHeader> decodeResponseHeader(std::string_view & data);
 
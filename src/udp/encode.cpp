@@ -29,6 +29,8 @@
 #include "encode.hpp"
 #include "udp/protocol.hpp"
 
+#include <algorithm>
+
 namespace dr {
 namespace yaskawa {
 namespace udp {
@@ -74,41 +76,33 @@ RequestHeader makeFileRequestHeader(
 	return header;
 }
 
-void encode(std::vector<std::uint8_t> & out, RequestHeader const & header) {
-	out.reserve(out.size() + header_size + header.payload_size);
-	// Magic bytes.
-	out.insert(out.end(), {'Y', 'E', 'R', 'C'});
-
-	// Header size, payload size.
-	writeLittleEndian<std::uint16_t>(out, header_size);
-	writeLittleEndian<std::uint16_t>(out, header.payload_size);
-
-	// Reserved magic constant.
-	out.push_back(3);
+void encode(std::array<std::uint8_t, header_size> & out, RequestHeader const & header) {
+	// Start from the template and fill in the variable fields.
+	out = request_header_template;
+	std::uint8_t * data = out.data();
+	storeLittleEndian<std::uint16_t>(data + header_offset::payload_size, header.payload_size);
 
 	// "Division" (robot command or file command)
-	out.push_back(std::uint8_t(header.division));
+	data[header_offset::division] = std::uint8_t(header.division);
 
 	// Ack (should always be zero for requests).
-	out.push_back(header.ack);
-
-	// Request ID.
-	out.push_back(header.request_id);
-
-	// Block number.
-	writeLittleEndian<std::uint32_t>(out, header.block_number);
+	data[header_offset::ack] = header.ack;
 
-	// Reserved.
-	out.insert(out.end(), 8, '9');
+	data[header_offset::request_id] = header.request_id;
+	storeLittleEndian<std::uint32_t>(data + header_offset::block_number, header.block_number);
 
 	// Subrequest details
-	writeLittleEndian<std::uint16_t>(out, header.command);
-	writeLittleEndian<std::uint16_t>(out, header.instance);
-	out.push_back(header.attribute);
-	out.push_back(header.service);
+	storeLittleEndian<std::uint16_t>(data + header_offset::command,  header.command);
+	storeLittleEndian<std::uint16_t>(data + header_offset::instance, header.instance);
+	data[header_offset::attribute] = header.attribute;
+	data[header_offset::service]   = header.service;
+}
 
-	// Padding.
-	out.insert(out.end(), 2, 0);
+void encode(std::vector<std::uint8_t> & out, RequestHeader const & header) {
+	out.reserve(out.size() + header_size + header.payload_size);
+	std::array<std::uint8_t, header_size> encoded;
+	encode(encoded, header);
+	out.insert(out.end(), encoded.begin(), encoded.end());
 }
 
 void encode(std::vector<std::uint8_t> & out, std::uint8_t value) {
@@ -136,52 +130,71 @@ namespace {
 	}
 }
 
-void encode(std::vector<std::uint8_t> & out, Position const & position) {
+namespace {
+	/// Number of 32 bit words in an encoded position.
+	constexpr std::size_t position_words = 13;
+
+	/// Scale factors to convert cartesian coordinates to micrometers and millidegrees.
+	constexpr std::array<double, 6> cartesian_scale{{1000, 1000, 1000, 10000, 10000, 10000}};
+
+	/// Store the words of an encoded position in little-endian order.
+	void storeWords(std::uint8_t * out, std::array<std::int32_t, position_words> const & words) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		std::memcpy(out, words.data(), sizeof(words));
+#else
+		for (std::size_t i = 0; i < position_words; ++i) storeLittleEndian<std::int32_t>(out + 4 * i, words[i]);
+#endif
+	}
+}
+
+void encode(std::uint8_t * out, PulsePosition const & position) {
+	std::array<std::int32_t, position_words> words{};
+	// Position type (pulse), joint configuration, user coordinate and extended joint configuration stay 0.
+	// The tool number is also meaningless for pulse positions?
+	words[2] = position.tool();
+	// Invividual joint values in pulses, padded with zeros (robot wants 8 coordinates).
+	std::copy(position.joints().begin(), position.joints().end(), words.begin() + 5);
+	storeWords(out, words);
+}
+
+void encode(std::uint8_t * out, CartesianPosition const & position) {
+	std::array<std::int32_t, position_words> words{};
+	words[0] = encodeFrameType(position.frame());
+	words[1] = position.configuration();
+	words[2] = position.tool();
+	words[3] = userCoordinateNumber(position.frame());
+	// Extended joint configuration (not supported) and the padding (robot wants 8 coordinates) stay 0.
+	// XYZ components in micrometer, rotation components in millidegrees.
+	for (std::size_t i = 0; i < cartesian_scale.size(); ++i) words[5 + i] = std::int32_t(position[i] * cartesian_scale[i]);
+	storeWords(out, words);
+}
+
+void encode(std::uint8_t * out, Position const & position) {
 	if (position.isPulse()) encode(out, position.pulse());
 	else encode(out, position.cartesian());
 }
 
+void encode(std::vector<std::uint8_t> & out, Position const & position) {
+	encode(out, &position, 1);
+}
+
 void encode(std::vector<std::uint8_t> & out, PulsePosition const & position) {
-	// Position type: pulse.
-	writeLittleEndian<std::uint32_t>(out, 0);
-	// Joint configuration, meaningless with pulse positions.
-	writeLittleEndian<std::uint32_t>(out, 0);
-	// Tool number. Also meaningless for pulse positions?
-	writeLittleEndian<std::uint32_t>(out, position.tool());
-	// User coordinate: meaningless for pulse position.
-	writeLittleEndian<std::uint32_t>(out, 0);
-	// Extended joint configuration, meaningless with pulse positions.
-	writeLittleEndian<std::uint32_t>(out, 0);
-	// Invividual joint values in pulses.
-	for (std::int32_t value : position.joints()) writeLittleEndian<std::int32_t>(out, value);
-	// Padding (robot wants 8 coordinates).
-	for (unsigned int i = position.joints().size(); i < 8; ++i) {
-		writeLittleEndian<std::int32_t>(out, 0);
-	}
+	std::size_t offset = out.size();
+	out.resize(offset + position_words * 4);
+	encode(out.data() + offset, position);
 }
 
 void encode(std::vector<std::uint8_t> & out, CartesianPosition const & position) {
-	// Position type.
-	writeLittleEndian<std::uint32_t>(out, encodeFrameType(position.frame()));
-	// Joint configuration.
-	writeLittleEndian<std::uint32_t>(out, position.configuration());
-	// Tool number.
-	writeLittleEndian<std::uint32_t>(out, position.tool());
-	// User coordinate system.
-	writeLittleEndian<std::uint32_t>(out, userCoordinateNumber(position.frame()));
-	// Extended joint configuration, not supported.
-	writeLittleEndian<std::uint32_t>(out, 0);
-	// XYZ components in micrometer.
-	writeLittleEndian<std::int32_t>(out, position[0] * 1000);
-	writeLittleEndian<std::int32_t>(out, position[1] * 1000);
-	writeLittleEndian<std::int32_t>(out, position[2] * 1000);
-	// Rotation components in millidegrees.
-	writeLittleEndian<std::int32_t>(out, position[3] * 10000);
-	writeLittleEndian<std::int32_t>(out, position[4] * 10000);
-	writeLittleEndian<std::int32_t>(out, position[5] * 10000);
-	// Padding (robot wants 8 coordinates).
-	writeLittleEndian<std::int32_t>(out, 0);
-	writeLittleEndian<std::int32_t>(out, 0);
+	std::size_t offset = out.size();
+	out.resize(offset + position_words * 4);
+	encode(out.data() + offset, position);
+}
+
+void encode(std::vector<std::uint8_t> & out, Position const * positions, std::size_t count) {
+	std::size_t offset = out.size();
+	out.resize(offset + count * position_words * 4);
+	std::uint8_t * data = out.data() + offset;
+	for (std::size_t i = 0; i < count; ++i) encode(data + i * position_words * 4, positions[i]);
 }
 
 }}}
@@ -30,7 +30,9 @@
 #include "types.hpp"
 #include "udp/message.hpp"
 
+#include <array>
 #include <cstdint>
+#include <cstring>
 #include <type_traits>
 #include <vector>
 
@@ -55,14 +57,52 @@ RequestHeader makeFileRequestHeader(
 	bool ack = false
 );
 
+/// Encoded request header with all fixed fields filled in.
+/**
+ * Only the fields listed in header_offset need to be written on top of this template.
+ */
+constexpr std::array<std::uint8_t, header_size> request_header_template{{
+	'Y', 'E', 'R', 'C',                     // Magic bytes.
+	header_size, 0,                         // Header size.
+	0, 0,                                   // Payload size.
+	3,                                      // Reserved magic constant.
+	0,                                      // Division.
+	0,                                      // Ack.
+	0,                                      // Request ID.
+	0, 0, 0, 0,                             // Block number.
+	'9', '9', '9', '9', '9', '9', '9', '9', // Reserved.
+	0, 0,                                   // Command.
+	0, 0,                                   // Instance.
+	0,                                      // Attribute.
+	0,                                      // Service.
+	0, 0,                                   // Padding.
+}};
+
+/// Store little-endian integral data at a fixed position in a byte buffer.
 template<typename T>
-void writeLittleEndian(std::vector<std::uint8_t> & out, T value) {
+void storeLittleEndian(std::uint8_t * out, T value) {
 	static_assert(std::is_integral<T>::value, "T must be an integral type.");
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	std::memcpy(out, &value, sizeof(T));
+#else
 	for (unsigned int i = 0; i < sizeof(T); ++i) {
-		out.push_back(value >> i * 8 & 0xff);
+		out[i] = value >> i * 8 & 0xff;
 	}
+#endif
 }
 
+/// Append little-endian integral data to a byte buffer.
+template<typename T>
+void writeLittleEndian(std::vector<std::uint8_t> & out, T value) {
+	std::size_t offset = out.size();
+	out.resize(offset + sizeof(T));
+	storeLittleEndian<T>(out.data() + offset, value);
+}
+
+/// Encode a request header into a buffer of exactly header_size bytes.
+void encode(std::array<std::uint8_t, header_size> & out, RequestHeader const & header);
+
+/// Append an encoded request header to a byte buffer.
 void encode(std::vector<std::uint8_t> & out, RequestHeader const & header);
 void encode(std::vector<std::uint8_t> & out, std::uint8_t value);
 void encode(std::vector<std::uint8_t> & out, std::int16_t value);
@@ -72,4 +112,16 @@ void encode(std::vector<std::uint8_t> & out, PulsePosition const & position);
 void encode(std::vector<std::uint8_t> & out, CartesianPosition const & position);
 void encode(std::vector<std::uint8_t> & out, Position const & position);
 
+/// Encode a position into a buffer of exactly encoded_size<Position>() bytes.
+void encode(std::uint8_t * out, PulsePosition const & position);
+void encode(std::uint8_t * out, CartesianPosition const & position);
+void encode(std::uint8_t * out, Position const & position);
+
+/// Append an array of encoded positions to a byte buffer.
+/**
+ * The buffer is resized once and the positions are encoded in place,
+ * which is a lot faster than appending them one value at a time when uploading a path.
+ */
+void encode(std::vector<std::uint8_t> & out, Position const * positions, std::size_t count);
+
 }}}
@@ -34,6 +34,10 @@
 #include "encode.hpp"
 #include "decode.hpp"
 
+#include <string>
+#include <system_error>
+#include <type_traits>
+
 namespace dr {
 namespace yaskawa {
 namespace udp {
@@ -105,11 +109,10 @@ void encode(std::vector<std::uint8_t> & output, std::uint8_t request_id, ReadCur
 Result<Position> decode(ResponseHeader const &, std::string_view & message, ReadCurrentPosition const &) {
 	if (auto error = expectSizeMax("position data", message.size(), 13 * 4)) return error;
 
-	// Pad the data until it is 13 * 4 bytes.
-	std::string padded_data;
-	padded_data.resize(13 * 4, '\0');
+	// Pad the data until it is 13 * 4 bytes, on the stack to avoid an allocation per position read.
+	std::array<char, 13 * 4> padded_data{};
 	std::copy(message.begin(), message.end(), padded_data.begin());
-	std::string_view padded_view = padded_data;
+	std::string_view padded_view{padded_data.data(), padded_data.size()};
 	return decode<Position>(padded_view);
 }
 
@@ -197,34 +200,62 @@ namespace {
 		return decode<T>(message);
 	}
 
-	/// Decode a ReadVars response.
+	/// Decode a ReadVars response into storage for the requested number of values.
 	template<typename T>
-	Result<std::vector<T>> decodeReadVars(std::string_view & message, ReadVars<T> const & command) {
+	Result<void> decodeReadVarsInto(std::string_view & message, std::size_t count, T * output) {
 		// Read a single value (data is exactly one element).
-		if (command.count == 1) {
-			Result<T> result = decodeReadVar<T>(message, {command.index});
+		if (count == 1) {
+			Result<T> result = decodeReadVar<T>(message, {});
 			if (!result) return result.error_unchecked();
-			return std::vector<T>{*result};
+			output[0] = std::move(*result);
+			return estd::in_place_valid;
 		}
 
 		// Read multiple values (data starts with a 32 bit value count).
-		if (auto error = expectSize( "response data", message.size(), 4 + command.count * encoded_size<T>())) return error;
+		if (auto error = expectSize( "response data", message.size(), 4 + count * encoded_size<T>())) return error;
 
 		// Check if value count matches our request.
-		std::uint32_t count = readLittleEndian<std::uint32_t>(message);
-		if (auto error = expectValue("value count", count, command.count)) return error;
+		std::uint32_t actual_count = readLittleEndian<std::uint32_t>(message);
+		if (auto error = expectValue("value count", actual_count, count)) return error;
+
+		// Plain numbers can be copied in bulk, since the size has already been checked.
+		if constexpr (std::is_arithmetic<T>::value) {
+			static_assert(encoded_size<T>() == sizeof(T), "encoded size must match the in-memory size");
+			readLittleEndianArray(reinterpret_cast<std::uint8_t const *>(message.data()), count, output);
+			message.remove_prefix(count * sizeof(T));
+			return estd::in_place_valid;
+		}
 
-		// Decode and return values.
-		std::vector<T> result;
-		result.reserve(command.count);
-		for (std::size_t i = 0; i < command.count; ++i) {
+		// Decode the values one by one.
+		for (std::size_t i = 0; i < count; ++i) {
 			Result<T> decoded = decode<T>(message);
 			if (!decoded) return decoded.error_unchecked();
-			result.push_back(*decoded);
+			output[i] = std::move(*decoded);
 		}
+		return estd::in_place_valid;
+	}
+
+	/// Decode a ReadVars response.
+	template<typename T>
+	Result<std::vector<T>> decodeReadVars(std::string_view & message, ReadVars<T> const & command) {
+		std::vector<T> result(command.count);
+		Result<void> decoded = decodeReadVarsInto(message, command.count, result.data());
+		if (!decoded) return decoded.error_unchecked();
 		return result;
 	}
 
+	/// Encode a ReadVarsInto command.
+	template<typename T>
+	void encodeReadVarsInto(std::vector<std::uint8_t> & output, std::uint8_t request_id, ReadVarsInto<T> const & command) {
+		encodeReadVars(output, request_id, ReadVars<T>{command.index, command.count});
+	}
+
+	/// Decode a ReadVarsInto response.
+	template<typename T>
+	Result<void> decodeReadVarsInto(std::string_view & message, ReadVarsInto<T> const & command) {
+		return decodeReadVarsInto(message, command.count, command.output);
+	}
+
 	/// Encode a WriteVar command.
 	template<typename T>
 	void encodeWriteVar(std::vector<std::uint8_t> & output, std::uint8_t request_id, WriteVar<T> const & command) {
@@ -248,7 +279,11 @@ namespace {
 			std::uint32_t data_size = 4 + command.values.size() * encoded_size<T>();
 			encode(output, makeRobotRequestHeader(data_size, udp_command<WriteVars<T>>(), command.index, 0, service::write_multiple, request_id));
 			writeLittleEndian<std::uint32_t>(output, command.values.size());
-			for (auto const & val : command.values) encode(output, val);
+			if constexpr (std::is_same<T, Position>::value) {
+				encode(output, command.values.data(), command.values.size());
+			} else {
+				for (auto const & val : command.values) encode(output, val);
+			}
 		}
 	}
 
@@ -265,15 +300,43 @@ namespace {
 		if (auto error = expectSize("response data", data.size(), 0)) return error;
 		return estd::in_place_valid;
 	}
+
+	/// Check that a range of variables is not empty, fits in a single request and does not run past the highest variable index.
+	/**
+	 * The controller only accepts an even number of B variables in a multiple variable request,
+	 * so odd ranges of more than one B variable are rejected as well.
+	 * A single variable is encoded as a single variable request, which is accepted for any type.
+	 */
+	template<typename T>
+	Error validateVarRange(std::size_t index, std::size_t count) {
+		if (count == 0) {
+			return Error{std::errc::invalid_argument, "variable range at index " + std::to_string(index) + " is empty"};
+		}
+		if (std::is_same<T, std::uint8_t>::value && count != 1 && count % 2 != 0) {
+			return Error{std::errc::invalid_argument, "variable range of " + std::to_string(count) + " B variables is odd, but B variables can only be accessed in even numbers"};
+		}
+		if (count > max_multiple_count<T>::value) {
+			return Error{std::errc::invalid_argument, "variable range of " + std::to_string(count) + " exceeds the maximum of " + std::to_string(max_multiple_count<T>::value) + " per request"};
+		}
+		if (index + count - 1 > 0xffff) {
+			return Error{std::errc::invalid_argument, "variable range " + std::to_string(index) + " + " + std::to_string(count) + " exceeds the highest variable index"};
+		}
+		return {};
+	}
 }
 
 #define DEFINE_VAR(TYPE) \
+Error validate(ReadVars<TYPE> const & cmd)     { return validateVarRange<TYPE>(cmd.index, cmd.count); } \
+Error validate(ReadVarsInto<TYPE> const & cmd) { return validateVarRange<TYPE>(cmd.index, cmd.count); } \
+Error validate(WriteVars<TYPE> const & cmd)    { return validateVarRange<TYPE>(cmd.index, cmd.values.size()); } \
 void encode(std::vector<std::uint8_t> & out, std::uint8_t id, ReadVar<TYPE> const & cmd) { return encodeReadVar(out, id, cmd); } \
 void encode(std::vector<std::uint8_t> & out, std::uint8_t id, ReadVars<TYPE> const & cmd) { return encodeReadVars(out, id, cmd); } \
+void encode(std::vector<std::uint8_t> & out, std::uint8_t id, ReadVarsInto<TYPE> const & cmd) { return encodeReadVarsInto(out, id, cmd); } \
 void encode(std::vector<std::uint8_t> & out, std::uint8_t id, WriteVar<TYPE> const & cmd) { return encodeWriteVar(out, id, cmd); } \
 void encode(std::vector<std::uint8_t> & out, std::uint8_t id, WriteVars<TYPE> const & cmd) { return encodeWriteVars(out, id, cmd); } \
 Result<TYPE> decode(ResponseHeader const &, std::string_view & data, ReadVar<TYPE> const & cmd) { return decodeReadVar(data, cmd); } \
 Result<std::vector<TYPE>> decode(ResponseHeader const &, std::string_view & data,  ReadVars<TYPE> const & cmd) { return decodeReadVars  (data, cmd); } \
+Result<void> decode(ResponseHeader const &, std::string_view & data, ReadVarsInto<TYPE> const & cmd) { return decodeReadVarsInto(data, cmd); } \
 Result<void> decode(ResponseHeader const &, std::string_view & data, WriteVar<TYPE> const & cmd) { return decodeWriteVar(data, cmd); } \
 Result<void> decode(ResponseHeader const &, std::string_view & data, WriteVars<TYPE> const & cmd) { return decodeWriteVars(data, cmd); }
 
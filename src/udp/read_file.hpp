@@ -33,13 +33,13 @@
 #include "encode.hpp"
 #include "decode.hpp"
 
-#include <asio/steady_timer.hpp>
-
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <string>
 #include <string_view>
 #include <system_error>
 #include <utility>
@@ -49,6 +49,12 @@ namespace yaskawa {
 namespace udp {
 namespace impl {
 
+/// Session for a file transfer from the controller.
+/**
+ * Received blocks are copied into a single string as they arrive, instead of keeping their receive buffers.
+ * A transfer can have many blocks, and keeping a receive buffer for each of them
+ * would drain the buffer pool for the whole transfer, while the blocks would still have to be joined at the end.
+ */
 template<typename Command>
 class ReadFileSession : public std::enable_shared_from_this<ReadFileSession<Command>> {
 	using Response         = typename Command::Response;
@@ -57,47 +63,77 @@ class ReadFileSession : public std::enable_shared_from_this<ReadFileSession<Comm
 
 public:
 	Client * client_;
-	std::uint8_t request_id_;
+	std::uint8_t request_id_ = 0;
 	Command command_;
+	Client::QueueToken queued_ = 0;
 	Client::HandlerToken handler_;
-	asio::steady_timer timer_;
-	std::chrono::milliseconds timeout_;
+	Client::DeadlineToken deadline_ = 0;
+
+	/// Time at which the transfer fails if it did not finish yet.
+	std::chrono::steady_clock::time_point end_time_;
 	std::vector<std::uint8_t> write_buffer_;
 	std::string read_buffer_;
+	std::size_t blocks_received_ = 0;
 
 	DoneCallback on_done_;
 	ProgressCallback on_progress_;
 
 	std::atomic_bool done_{false};
-	std::size_t blocks_received_ = 0;
 
 public:
 	/// Construct a command session.
 	ReadFileSession(
 		Client & client,
-		std::uint8_t request_id,
 		Command command,
-		std::chrono::milliseconds timeout,
+		std::chrono::steady_clock::time_point end_time,
 		DoneCallback on_done,
 		ProgressCallback on_progress = nullptr
 	) :
 		client_(&client),
-		request_id_{request_id},
 		command_{std::move(command)},
-		timer_(client.ios()),
-		timeout_{timeout},
+		end_time_{end_time},
 		on_done_(std::move(on_done)),
 		on_progress_(std::move(on_progress))
 	{
 		read_buffer_.reserve(1024);
-
-		// Encode the command.
-		encode(write_buffer_, request_id, command_);
 	}
 
 	void start() {
+		// Reserve a request ID, or wait in the submission queue for one.
+		Result<Client::QueueToken> queued = client_->reserveId([this, self = self()] (std::uint8_t request_id) {
+			queued_ = 0;
+			send(request_id);
+		});
+		if (!queued) {
+			client_->ios().post([this, self = self(), error = std::move(queued.error_unchecked())] () {
+				stopSession(error);
+			});
+			return;
+		}
+		queued_ = *queued;
+
+		// Start the timeout.
+		startTimeout();
+	}
+
+	/// Stop the transfer with asio::error::operation_aborted.
+	void cancel() {
+		stopSession(Error{asio::error::operation_aborted});
+	}
+
+protected:
+	/// Get a shared pointer to this session.
+	std::shared_ptr<ReadFileSession> self() { return this->shared_from_this(); }
+
+	/// Encode and send the command once we have a request ID.
+	void send(std::uint8_t request_id) {
+		request_id_ = request_id;
+
+		// Encode the command.
+		encode(write_buffer_, request_id_, command_);
+
 		// Register the response handler.
-		handler_ = client_->registerHandler(request_id_, [this, self = self()] (ResponseHeader const & header, std::string_view data) {
+		handler_ = client_->registerHandler(request_id_, [this, self = self()] (ResponseHeader const & header, std::string_view data, ReceiveBuffer const &) {
 			onResponse(header, data);
 		});
 
@@ -105,15 +141,8 @@ public:
 		client_->socket().async_send(asio::buffer(write_buffer_.data(), write_buffer_.size()), [this, self = self()] (std::error_code error, std::size_t) {
 			if (error) return stopSession(Error(error, "writing command for request " + std::to_string(request_id_)));
 		});
-
-		// Start the timeout.
-		resetTimeout();
 	}
 
-protected:
-	/// Get a shared pointer to this session.
-	std::shared_ptr<ReadFileSession> self() { return this->shared_from_this(); }
-
 	/// Write an ack for a data block.
 	void writeAck(std::uint32_t block_number) {
 		auto buffer = std::make_shared<std::vector<std::uint8_t>>();
@@ -134,47 +163,52 @@ protected:
 		if (auto error = expectValue("block number", block, blocks_received_ + 1)) return stopSession(error);
 		writeAck(block);
 
-		read_buffer_.insert(read_buffer_.end(), data.begin(), data.end());
+		// Copy the block right away, so the receive buffer can be reused for the next block.
+		read_buffer_.append(data);
+		++blocks_received_;
 
 		if (on_progress_) on_progress_(read_buffer_.size());
 		if (last_block) stopSession(decode(header, std::move(read_buffer_), command_));
 	}
 
-	void resetTimeout() {
-		timer_.expires_from_now(timeout_);
-		timer_.async_wait([this, self = self()] (std::error_code error) {
-			if (error == asio::error::operation_aborted) return;
-			if (error) return stopSession(Error(error, "waiting for reply to request " + std::to_string(request_id_)));
+	void startTimeout() {
+		client_->cancelDeadline(deadline_);
+		deadline_ = client_->scheduleDeadline(end_time_, [this, self = self()] () {
+			deadline_ = 0;
 			stopSession(Error(std::errc::timed_out, "waiting for reply to request " + std::to_string(request_id_)));
 		});
 	}
 
 	void stopSession(Result<Response> result) {
 		if (done_.exchange(true)) return;
-		timer_.cancel();
+		client_->cancelDeadline(std::exchange(deadline_, 0));
+		client_->cancelReservation(queued_);
 		client_->removeHandler(handler_);
 		return on_done_(result);
 	}
 };
 
+/// Start a file transfer that must finish before the end time.
+/**
+ * \return the session, which can be connected to a cancellation signal.
+ */
 template<typename Command>
-void readFile(
+std::shared_ptr<ReadFileSession<std::decay_t<Command>>> readFile(
 	Client & client,
-	std::uint8_t request_id,
 	Command && command,
-	std::chrono::milliseconds timeout,
+	std::chrono::steady_clock::time_point end_time,
 	std::function<void(Result<typename Command::Response>)> on_done,
 	std::function<void(std::size_t bytes_received)> on_progress
 ) {
 	auto session = std::make_shared<ReadFileSession<std::decay_t<Command>>>(
 		client,
-		request_id,
 		std::forward<Command>(command),
-		timeout,
+		end_time,
 		std::move(on_done),
 		std::move(on_progress)
 	);
 	session->start();
+	return session;
 }
 
 }}}}
@@ -0,0 +1,86 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "udp/receive_buffer.hpp"
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+void ReceiveBuffer::reset() {
+	if (!block_) return;
+	impl::ReceiveBlock * block = std::exchange(block_, nullptr);
+	if (--block->references > 0) return;
+
+	impl::ReceiveBufferStore * store = block->store;
+	--store->in_use;
+
+	// The pool is gone, so free the buffer (and the store if this was the last buffer).
+	if (store->detached) {
+		delete block;
+		if (store->in_use == 0) delete store;
+		return;
+	}
+
+	if (store->free.size() < store->max_free) {
+		store->free.emplace_back(block);
+	} else {
+		delete block;
+	}
+}
+
+ReceiveBufferPool::ReceiveBufferPool(std::size_t max_free) :
+	store_{new impl::ReceiveBufferStore}
+{
+	store_->max_free = max_free;
+}
+
+ReceiveBufferPool::~ReceiveBufferPool() {
+	// Keep the store alive until all buffers in use are released.
+	store_->free.clear();
+	if (store_->in_use == 0) {
+		delete store_;
+	} else {
+		store_->detached = true;
+	}
+}
+
+ReceiveBuffer ReceiveBufferPool::acquire() {
+	std::unique_ptr<impl::ReceiveBlock> block;
+	if (store_->free.empty()) {
+		block = std::make_unique<impl::ReceiveBlock>();
+		block->store = store_;
+	} else {
+		block = std::move(store_->free.back());
+		store_->free.pop_back();
+	}
+	++store_->in_use;
+	return ReceiveBuffer{block.release()};
+}
+
+}}}
@@ -0,0 +1,193 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "commands.hpp"
+#include "recycling_allocator.hpp"
+#include "udp/cancellation.hpp"
+#include "udp/client.hpp"
+#include "udp/command_traits.hpp"
+#include "udp/message.hpp"
+#include "./var_batch.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <tuple>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+namespace impl {
+
+std::vector<VarRun> planRuns(std::vector<VarAccess> const & batch) {
+	std::vector<std::size_t> order(batch.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&] (std::size_t a, std::size_t b) {
+		VarAccess const & x = batch[a];
+		VarAccess const & y = batch[b];
+		return std::make_tuple(x.value.index(), x.write, x.index) < std::make_tuple(y.value.index(), y.write, y.index);
+	});
+
+	std::vector<VarRun> runs;
+	for (std::size_t entry : order) {
+		VarAccess const & access = batch[entry];
+		if (!runs.empty()) {
+			VarRun & run = runs.back();
+			std::size_t last = run.index + run.count - 1;
+			bool same_kind = run.type == access.value.index() && run.write == access.write;
+			std::size_t max_count = std::visit([] (auto const & value) {
+				return max_multiple_count<std::decay_t<decltype(value)>>::value;
+			}, access.value);
+
+			// Reads of the same variable share the request.
+			if (same_kind && !access.write && access.index == last) {
+				run.entries.push_back(entry);
+				continue;
+			}
+
+			if (same_kind && access.index == last + 1 && run.count < max_count) {
+				++run.count;
+				run.entries.push_back(entry);
+				continue;
+			}
+		}
+		runs.push_back({access.value.index(), access.write, access.index, 1, {entry}});
+	}
+
+	// B variables can only be read and written in even numbers, so split off the last variable of odd runs.
+	std::size_t planned = runs.size();
+	for (std::size_t i = 0; i < planned; ++i) {
+		VarRun & run = runs[i];
+		if (!std::holds_alternative<std::uint8_t>(batch[run.entries.front()].value) || run.count % 2 == 0 || run.count == 1) continue;
+		std::uint16_t last = run.index + run.count - 1;
+		auto split = std::find_if(run.entries.begin(), run.entries.end(), [&] (std::size_t entry) { return batch[entry].index == last; });
+		VarRun tail{run.type, run.write, last, 1, {split, run.entries.end()}};
+		run.entries.erase(split, run.entries.end());
+		--run.count;
+		runs.push_back(std::move(tail));
+	}
+
+	return runs;
+}
+
+}
+
+namespace {
+	/// Shared state of a variable batch.
+	struct VarBatchState {
+		std::vector<VarAccess> batch;
+		std::vector<impl::VarRun> runs;
+		std::vector<VarValue> results;
+		std::size_t remaining_runs;
+		bool done = false;
+		Client::VarBatchCallback callback;
+
+		/// Signal connected to the requests of all runs in the batch.
+		CancellationSignal sessions;
+
+		void resolve(Result<std::vector<VarValue>> result) {
+			if (done) return;
+			done = true;
+
+			// Stop the runs that are still in progress, so they don't outlive the batch.
+			sessions.cancel();
+			callback(std::move(result));
+		}
+	};
+
+	/// Send the request for a run of variables of type T.
+	/**
+	 * Runs of a single variable use the single variable commands,
+	 * so the value is decoded directly instead of into a vector of one element.
+	 */
+	template<typename T>
+	void sendRun(Client & client, std::chrono::steady_clock::time_point deadline, std::shared_ptr<VarBatchState> const & state, impl::VarRun const & run) {
+		if (run.write && run.count == 1) {
+			WriteVar<T> command{run.index, std::get<T>(state->batch[run.entries.front()].value)};
+			client.sendCommand(std::move(command), deadline, bindCancellation(state->sessions, [state] (Result<void> result) {
+				if (!result) return state->resolve(result.error_unchecked());
+				if (--state->remaining_runs == 0) state->resolve(std::move(state->results));
+			}));
+		} else if (run.write) {
+			WriteVars<T> command{run.index, {}};
+			command.values.reserve(run.count);
+			for (std::size_t entry : run.entries) command.values.push_back(std::get<T>(state->batch[entry].value));
+			client.sendCommand(std::move(command), deadline, bindCancellation(state->sessions, [state] (Result<void> result) {
+				if (!result) return state->resolve(result.error_unchecked());
+				if (--state->remaining_runs == 0) state->resolve(std::move(state->results));
+			}));
+		} else if (run.count == 1) {
+			client.sendCommand(ReadVar<T>{run.index}, deadline, bindCancellation(state->sessions, [state, &run] (Result<T> result) {
+				if (!result) return state->resolve(result.error_unchecked());
+				for (std::size_t entry : run.entries) state->results[entry] = *result;
+				if (--state->remaining_runs == 0) state->resolve(std::move(state->results));
+			}));
+		} else {
+			client.sendCommand(ReadVars<T>{run.index, std::uint16_t(run.count)}, deadline, bindCancellation(state->sessions, [state, &run] (Result<std::vector<T>> result) {
+				if (!result) return state->resolve(result.error_unchecked());
+				for (std::size_t entry : run.entries) {
+					state->results[entry] = (*result)[state->batch[entry].index - run.index];
+				}
+				if (--state->remaining_runs == 0) state->resolve(std::move(state->results));
+			}));
+		}
+	}
+}
+
+void Client::sendVarBatch(std::vector<VarAccess> batch, std::chrono::steady_clock::time_point deadline, VarBatchCallback callback) {
+	auto state = std::allocate_shared<VarBatchState>(RecyclingAllocator<VarBatchState>{});
+	state->runs           = impl::planRuns(batch);
+	state->results        = std::vector<VarValue>(batch.size());
+	state->remaining_runs = state->runs.size();
+	state->batch          = std::move(batch);
+	state->callback       = std::move(callback);
+
+	// Report an empty batch asynchronously, like any other result.
+	if (state->runs.empty()) {
+		ios().post(recycling([state] () { state->resolve(std::vector<VarValue>{}); }));
+		return;
+	}
+
+	// Writes report the written value.
+	for (std::size_t i = 0; i < state->batch.size(); ++i) {
+		if (state->batch[i].write) state->results[i] = state->batch[i].value;
+	}
+
+	for (impl::VarRun const & run : state->runs) {
+		std::visit([&] (auto const & value) {
+			sendRun<std::decay_t<decltype(value)>>(*this, deadline, state, run);
+		}, state->batch[run.entries.front()].value);
+	}
+}
+
+}}}
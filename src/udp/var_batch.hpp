@@ -0,0 +1,68 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "commands.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+namespace impl {
+
+/// Adjacent variables of the same type, read or written with a single request.
+struct VarRun {
+	/// Type of the variables, as index in VarValue.
+	std::size_t type;
+	bool write;
+
+	/// Index of the first variable.
+	std::uint16_t index;
+
+	/// Number of variables.
+	std::size_t count;
+
+	/// Entries in the batch handled by the run, sorted by variable index.
+	/**
+	 * Reads of the same variable share a run, so there can be more entries than variables.
+	 */
+	std::vector<std::size_t> entries;
+};
+
+/// Sort a batch and merge adjacent variables into runs.
+/**
+ * Runs are limited to the number of variables that fit in a single request,
+ * and runs of B variables with an odd length have their last variable split off into a run of its own.
+ * Runs of a single variable are sent as a single variable request.
+ */
+std::vector<VarRun> planRuns(std::vector<VarAccess> const & batch);
+
+}}}}
@@ -33,10 +33,9 @@
 #include "encode.hpp"
 #include "decode.hpp"
 
-#include <asio/steady_timer.hpp>
-
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <memory>
@@ -62,11 +61,14 @@ class WriteFileSession : public std::enable_shared_from_this<WriteFileSession<Co
 	using ProgressCallback = std::function<void(std::size_t bytes_written, std::size_t total_bytes)>;
 
 	Client * client_;
-	std::uint8_t request_id_;
+	std::uint8_t request_id_ = 0;
 	WriteFile command_;
+	Client::QueueToken queued_ = 0;
 	Client::HandlerToken handler_;
-	asio::steady_timer timer_;
-	std::chrono::milliseconds timeout_;
+	Client::DeadlineToken deadline_ = 0;
+
+	/// Time at which the transfer fails if it did not finish yet.
+	std::chrono::steady_clock::time_point end_time_;
 	std::vector<std::uint8_t> write_buffer_;
 
 	DoneCallback on_done_;
@@ -79,27 +81,58 @@ public:
 	/// Construct a command session.
 	WriteFileSession(
 		Client & client,
-		std::uint8_t request_id,
 		WriteFile command,
-		std::chrono::milliseconds timeout,
+		std::chrono::steady_clock::time_point end_time,
 		DoneCallback on_done,
 		ProgressCallback on_progress = nullptr
 	) :
 		client_(&client),
-		request_id_{request_id},
 		command_{std::move(command)},
-		timer_(client.ios()),
-		timeout_{timeout},
+		end_time_{end_time},
 		on_done_(std::move(on_done)),
 		on_progress_(std::move(on_progress))
 	{}
 
 	void start() {
+		// Reserve a request ID, or wait in the submission queue for one.
+		Result<Client::QueueToken> queued = client_->reserveId([this, self = self()] (std::uint8_t request_id) {
+			queued_ = 0;
+			send(request_id);
+		});
+		if (!queued) {
+			client_->ios().post([this, self = self(), error = std::move(queued.error_unchecked())] () {
+				stopSession(error);
+			});
+			return;
+		}
+		queued_ = *queued;
+
+		// Start the timeout.
+		startTimeout();
+	}
+
+	/// Stop the transfer with asio::error::operation_aborted.
+	void cancel() {
+		stopSession(Error{asio::error::operation_aborted});
+	}
+
+protected:
+	std::size_t bytesSent() const {
+		return std::min(blocks_sent_ * max_payload_size, command_.data.size());
+	}
+
+	/// Get a shared pointer to this session.
+	std::shared_ptr<WriteFileSession> self() { return this->shared_from_this(); }
+
+	/// Encode and send the command once we have a request ID.
+	void send(std::uint8_t request_id) {
+		request_id_ = request_id;
+
 		// Encode the command.
 		encode(write_buffer_, request_id_, command_);
 
 		// Register the response handler.
-		handler_ = client_->registerHandler(request_id_, [this, self = self()] (ResponseHeader const & header, std::string_view data) {
+		handler_ = client_->registerHandler(request_id_, [this, self = self()] (ResponseHeader const & header, std::string_view data, ReceiveBuffer const &) {
 			onResponse(header, data);
 		});
 
@@ -108,19 +141,8 @@ public:
 			if (done_.load()) return;
 			if (error) return stopSession(Error{error, "writing command for request " + std::to_string(request_id_)});
 		});
-
-		// Start the timeout.
-		resetTimeout();
 	}
 
-protected:
-	std::size_t bytesSent() const {
-		return std::min(blocks_sent_ * max_payload_size, command_.data.size());
-	}
-
-	/// Get a shared pointer to this session.
-	std::shared_ptr<WriteFileSession> self() { return this->shared_from_this(); }
-
 	void writeNextBlock() {
 		std::size_t bytes_sent = blocks_sent_ * max_payload_size;
 		std::size_t remaining  = command_.data.size() - bytes_sent;
@@ -158,41 +180,44 @@ protected:
 		if (bytesSent() >= command_.data.size()) stopSession(estd::in_place_valid);
 	}
 
-	void resetTimeout() {
-		timer_.expires_from_now(timeout_);
-		timer_.async_wait([this, self=self()] (std::error_code error) {
-			if (error == asio::error::operation_aborted) return;
-			if (error) return stopSession(Error(error, "waiting for reply to request " + std::to_string(request_id_)));
+	void startTimeout() {
+		client_->cancelDeadline(deadline_);
+		deadline_ = client_->scheduleDeadline(end_time_, [this, self = self()] () {
+			deadline_ = 0;
 			stopSession(Error(std::errc::timed_out, "waiting for reply to request " + std::to_string(request_id_)));
 		});
 	}
 
 	void stopSession(Result<void> result) {
 		if (done_.exchange(true)) return;
-		timer_.cancel();
+		client_->cancelDeadline(std::exchange(deadline_, 0));
+		client_->cancelReservation(queued_);
 		client_->removeHandler(handler_);
 		return on_done_(result);
 	}
 };
 
+/// Start a file transfer that must finish before the end time.
+/**
+ * \return the session, which can be connected to a cancellation signal.
+ */
 template<typename Command>
-void writeFile(
+std::shared_ptr<WriteFileSession<std::decay_t<Command>>> writeFile(
 	Client & client,
-	std::uint8_t request_id,
 	Command command,
-	std::chrono::milliseconds timeout,
+	std::chrono::steady_clock::time_point end_time,
 	std::function<void(Result<void>)> on_done,
 	std::function<void(std::size_t bytes_sent, std::size_t total_bytes)> on_progress
 ) {
 	auto session = std::make_shared<WriteFileSession<std::decay_t<Command>>>(
 		client,
-		request_id,
 		std::forward<Command>(command),
-		timeout,
+		end_time,
 		std::move(on_done),
 		std::move(on_progress)
 	);
 	session->start();
+	return session;
 }
 
 }}}}